@@ -0,0 +1,125 @@
+/* A bump allocator for the many small objects of an index (nodes, words,
+* postings lists and file names) that all live until the index is thrown
+* away.  It avoids a malloc call and its bookkeeping per object, and
+* releasing the whole index is a walk over a few large blocks.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN 8
+
+/* Initialize an empty arena.  No memory is allocated until it is used.
+*/
+void init_arena(Arena *arena) {
+	arena->blocks = NULL;
+	arena->next = NULL;
+	arena->end = NULL;
+	arena->bytes = 0;
+}
+
+/* Allocate a block with room for size bytes.  A block for one large
+* allocation is linked behind the block being filled so that the space
+* left in that block is not lost; it never becomes the block being
+* filled itself, as its space is all taken.
+*/
+static char *new_block(Arena *arena, size_t size, int dedicated) {
+	ArenaBlock *block;
+	size_t header = (sizeof(ArenaBlock) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+	if((block = malloc(header + size)) == NULL) {
+		perror("arena:");
+		exit(1);
+	}
+	block->size = header + size;
+	arena->bytes += block->size;
+	if(dedicated && arena->blocks != NULL) {
+		block->next = arena->blocks->next;
+		arena->blocks->next = block;
+	} else if(dedicated) {
+		/* nothing is being filled yet, and nothing will be in this */
+		block->next = NULL;
+		arena->blocks = block;
+	} else {
+		block->next = arena->blocks;
+		arena->blocks = block;
+		arena->next = (char *)block + header;
+		arena->end = (char *)block + header + size;
+	}
+	return (char *)block + header;
+}
+
+/* Return size bytes of memory aligned for any of the index structures.
+* Never returns NULL; exits if memory runs out.
+*/
+void *arena_alloc(Arena *arena, size_t size) {
+	size_t pad = (ARENA_ALIGN - ((size_t)arena->next & (ARENA_ALIGN - 1))) & (ARENA_ALIGN - 1);
+	char *p;
+
+	if(arena->next != NULL && pad + size <= (size_t)(arena->end - arena->next)) {
+		p = arena->next + pad;
+		arena->next = p + size;
+		return p;
+	}
+	if(size > ARENA_BLOCKSIZE / 4) {
+		return new_block(arena, size, 1);
+	}
+	p = new_block(arena, ARENA_BLOCKSIZE, 0);
+	arena->next = p + size;
+	return p;
+}
+
+/* Copy the first len characters of s (which must have at least that
+* many) into the arena as a null terminated string.  Strings are not
+* aligned, so they pack tightly.
+*/
+char *arena_strdup(Arena *arena, const char *s, size_t len) {
+	char *p;
+
+	if(arena->next != NULL && len + 1 <= (size_t)(arena->end - arena->next)) {
+		p = arena->next;
+		arena->next += len + 1;
+	} else {
+		p = arena_alloc(arena, len + 1);
+	}
+	memcpy(p, s, len);
+	p[len] = '\0';
+	return p;
+}
+
+/* Move all the memory of from into into, so that objects allocated in
+* from now live as long as into.  from is left empty.
+*/
+void arena_adopt(Arena *into, Arena *from) {
+	ArenaBlock *last;
+
+	if(from->blocks == NULL) {
+		return;
+	}
+	if(into->blocks == NULL) {
+		*into = *from;
+	} else {
+		/* keep filling into's current block */
+		for(last = from->blocks; last->next != NULL; last = last->next) {
+		}
+		last->next = into->blocks->next;
+		into->blocks->next = from->blocks;
+		into->bytes += from->bytes;
+	}
+	init_arena(from);
+}
+
+/* Release every allocation made from the arena.
+*/
+void free_arena(Arena *arena) {
+	ArenaBlock *block, *next;
+
+	for(block = arena->blocks; block != NULL; block = next) {
+		next = block->next;
+		free(block);
+	}
+	init_arena(arena);
+}
@@ -0,0 +1,27 @@
+#include <stddef.h>
+
+#ifndef ARENA_BLOCKSIZE
+#define ARENA_BLOCKSIZE (1 << 20)
+#endif
+
+/* Memory is handed out from large blocks by bumping a pointer and is
+* only given back all at once, by free_arena.  An allocation larger than
+* a quarter of a block gets a block of its own.
+*/
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size;
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock *blocks;     /* the block being filled, if any, is first */
+    char *next;             /* free space left in that block */
+    char *end;
+    size_t bytes;           /* total size of the blocks */
+} Arena;
+
+void init_arena(Arena *arena);
+void *arena_alloc(Arena *arena, size_t size);
+char *arena_strdup(Arena *arena, const char *s, size_t len);
+void arena_adopt(Arena *into, Arena *from);
+void free_arena(Arena *arena);
@@ -0,0 +1,274 @@
+/* Benchmark the indexer and the query engine on a corpus laid out the
+* way query expects it (one subdirectory per index), such as the one
+* made by gencorpus.  Reports indexing throughput, index size, the
+* time for a worker to load an index, and query latency percentiles.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "freq_list.h"
+#include "diskindex.h"
+#include "search.h"
+#include "worker.h"
+#include "topk.h"
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(double *sorted, int n, double p) {
+    int i = (int)(p * (n - 1) + 0.5);
+    return n > 0 ? sorted[i] : 0.0;
+}
+
+static long long file_size(char *path) {
+    struct stat sbuf;
+    return stat(path, &sbuf) == -1 ? 0 : sbuf.st_size;
+}
+
+/* Run a program with its output discarded and, if infile is not NULL,
+* its input read from infile (and its per-query notes on stderr
+* discarded too).  Exits if the program fails.
+*/
+static void run(char **args, char *infile) {
+    pid_t pid;
+    int status, fd;
+    if ((pid = fork()) == -1) {
+        perror("fork");
+        exit(1);
+    } else if (pid == 0) {
+        if ((fd = open("/dev/null", O_WRONLY)) != -1) {
+            dup2(fd, STDOUT_FILENO);
+            if (infile != NULL) {
+                dup2(fd, STDERR_FILENO);
+            }
+        }
+        if (infile != NULL) {
+            if ((fd = open(infile, O_RDONLY)) == -1) {
+                perror(infile);
+                exit(1);
+            }
+            dup2(fd, STDIN_FILENO);
+        }
+        execv(args[0], args);
+        perror(args[0]);
+        exit(1);
+    }
+    if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "bench: %s failed\n", args[0]);
+        exit(1);
+    }
+}
+
+/* Sum the sizes of the files in a shard that will be indexed.
+*/
+static long long corpus_bytes(char *shard) {
+    char path[PATHLENGTH];
+    struct dirent *dp;
+    long long total = 0;
+    DIR *dir;
+    if ((dir = opendir(shard)) == NULL) {
+        perror(shard);
+        exit(1);
+    }
+    while ((dp = readdir(dir)) != NULL) {
+        if (dp->d_name[0] == '.' || strcmp(dp->d_name, "index") == 0 ||
+            strcmp(dp->d_name, "filenames") == 0) {
+            continue;
+        }
+        if (snprintf(path, PATHLENGTH, "%s/%s", shard, dp->d_name)
+            < PATHLENGTH) {
+            total += file_size(path);
+        }
+    }
+    closedir(dir);
+    return total;
+}
+
+int main(int argc, char **argv) {
+    char ch;
+    char *startdir = "bench_corpus";
+    char *queryfile = NULL;
+    char *threads = NULL;
+    int max_queries = 1000;
+    int skip_index = 0;
+    char path[PATHLENGTH], indexfile[PATHLENGTH], namefile[PATHLENGTH];
+    char **shards = NULL;
+    int num_shards = 0;
+    int i, q;
+
+    while ((ch = getopt(argc, argv, "d:q:n:j:x")) != -1) {
+        switch (ch) {
+            case 'd': startdir = optarg; break;
+            case 'q': queryfile = optarg; break;
+            case 'n': max_queries = strtol(optarg, NULL, 10); break;
+            case 'j': threads = optarg; break;
+            case 'x': skip_index = 1; break;
+            default:
+                fprintf(stderr, "Usage: bench [-d DIRECTORY_NAME] [-q QUERY_FILE]"
+                        " [-n MAX_QUERIES] [-j INDEXER_THREADS] [-x]\n");
+                exit(1);
+        }
+    }
+
+    DIR *dirp;
+    struct dirent *dp;
+    struct stat sbuf;
+    if ((dirp = opendir(startdir)) == NULL) {
+        perror(startdir);
+        exit(1);
+    }
+    while ((dp = readdir(dirp)) != NULL) {
+        if (dp->d_name[0] == '.') {
+            continue;
+        }
+        if (snprintf(path, PATHLENGTH, "%s/%s", startdir, dp->d_name)
+            >= PATHLENGTH) {
+            fprintf(stderr, "%s/%s: path too long\n", startdir, dp->d_name);
+            continue;
+        }
+        if (stat(path, &sbuf) == 0 && S_ISDIR(sbuf.st_mode)) {
+            shards = realloc(shards, (num_shards + 1) * sizeof(char *));
+            if (shards == NULL || (shards[num_shards++] = strdup(path)) == NULL) {
+                perror("malloc");
+                exit(1);
+            }
+        }
+    }
+    closedir(dirp);
+    if (num_shards == 0) {
+        fprintf(stderr, "bench: no subdirectories in %s\n", startdir);
+        exit(1);
+    }
+
+    /* Indexing throughput */
+    long long bytes = 0, words = 0, index_bytes = 0;
+    double start = now();
+    for (i = 0; i < num_shards; i++) {
+        snprintf(indexfile, PATHLENGTH, "%s/index", shards[i]);
+        snprintf(namefile, PATHLENGTH, "%s/filenames", shards[i]);
+        bytes += corpus_bytes(shards[i]);
+        if (!skip_index) {
+            char *args[] = { "./indexer", "-d", shards[i], "-i", indexfile,
+                             "-n", namefile, threads ? "-j" : NULL, threads, NULL };
+            run(args, NULL);
+        }
+    }
+    double index_time = now() - start;
+
+    /* Index size and worker load time */
+    DiskIndex *indexes = malloc(num_shards * sizeof(DiskIndex));
+    FileTable *files = malloc(num_shards * sizeof(FileTable));
+    double *load_times = malloc(num_shards * sizeof(double));
+    if (indexes == NULL || files == NULL || load_times == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    for (i = 0; i < num_shards; i++) {
+        snprintf(indexfile, PATHLENGTH, "%s/index", shards[i]);
+        snprintf(namefile, PATHLENGTH, "%s/filenames", shards[i]);
+        index_bytes += file_size(indexfile) + file_size(namefile);
+        start = now();
+        load_index(shards[i], &indexes[i], &files[i]);
+        load_times[i] = now() - start;
+        words += indexes[i].header->total_length;
+    }
+    qsort(load_times, num_shards, sizeof(double), compare_doubles);
+
+    printf("shards:        %d\n", num_shards);
+    if (!skip_index) {
+        printf("indexing:      %.1f MB, %lld words in %.3f s"
+               " (%.1f MB/s, %.0f words/s)\n",
+               bytes / 1e6, words, index_time, bytes / 1e6 / index_time,
+               words / index_time);
+    }
+    printf("index size:    %.1f MB (%.1f%% of the corpus)\n",
+           index_bytes / 1e6, bytes > 0 ? 100.0 * index_bytes / bytes : 0.0);
+    printf("worker load:   p50 %.3f ms, max %.3f ms\n",
+           percentile(load_times, num_shards, 0.5) * 1e3,
+           load_times[num_shards - 1] * 1e3);
+
+    /* Query latency: every query against every shard, merged in a top-K
+     * heap, as the query master does. */
+    if (queryfile == NULL) {
+        snprintf(path, PATHLENGTH, "%s/queries", startdir);
+        queryfile = path;
+    }
+    FILE *qfp;
+    if ((qfp = fopen(queryfile, "r")) == NULL) {
+        perror(queryfile);
+        exit(1);
+    }
+    double *latencies = malloc(max_queries * sizeof(double));
+    char line[MAXLINE];
+    TopK results;
+    FreqRecord *frp;
+    int num_queries = 0, file_queries = 0;
+    init_topk(&results, MAXRECORDS);
+    if (latencies == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    while (fgets(line, MAXLINE, qfp) != NULL) {
+        trim_query(line);
+        if (line[0] == '\0' || file_queries++ >= max_queries) {
+            continue;
+        }
+        start = now();
+        reset_topk(&results);
+        for (i = 0; i < num_shards; i++) {
+            frp = get_query(&indexes[i], &files[i], line, 0, MAXRECORDS);
+            for (q = 0; frp[q].freq != 0; q++) {
+                topk_add(&results, &frp[q]);
+            }
+            free(frp);
+        }
+        topk_sorted(&results);
+        latencies[num_queries++] = now() - start;
+    }
+    fclose(qfp);
+    if (num_queries > 0) {
+        double total = 0;
+        for (q = 0; q < num_queries; q++) {
+            total += latencies[q];
+        }
+        qsort(latencies, num_queries, sizeof(double), compare_doubles);
+        printf("lookup:        %d queries, p50 %.1f us, p99 %.1f us,"
+               " max %.1f us (%.0f queries/s)\n", num_queries,
+               percentile(latencies, num_queries, 0.5) * 1e6,
+               percentile(latencies, num_queries, 0.99) * 1e6,
+               latencies[num_queries - 1] * 1e6, num_queries / total);
+
+        /* End to end through the query program: process start, workers,
+         * pipes and output included. */
+        char *args[] = { "./query", "-d", startdir, NULL };
+        start = now();
+        run(args, queryfile);
+        double e2e = now() - start;
+        printf("query program: %d queries in %.3f s (%.1f us/query)\n",
+               file_queries, e2e, e2e / file_queries * 1e6);
+    }
+
+    for (i = 0; i < num_shards; i++) {
+        close_index(&indexes[i]);
+        free_filenames(&files[i]);
+    }
+    free_topk(&results);
+    return 0;
+}
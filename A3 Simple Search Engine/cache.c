@@ -0,0 +1,187 @@
+/* The query master's result cache: a chained hash table of entries that
+* are also linked in least recently used order.  An entry holds a copy
+* of the sorted top-K records of a query, so a hit is answered without
+* asking the workers.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "freq_list.h"
+#include "diskindex.h"
+#include "search.h"
+#include "worker.h"
+#include "cache.h"
+
+#define CACHE_INITIAL_BUCKETS 256
+
+static unsigned int hash_key(const char *key) {
+    unsigned int h = 2166136261u;
+    while (*key != '\0') {
+        h ^= (unsigned char)*key++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Initialize an empty cache that holds at most budget bytes of entries.
+* A budget of 0 disables the cache: nothing is ever stored.
+*/
+void init_cache(Cache *cache, size_t budget) {
+    cache->num_buckets = CACHE_INITIAL_BUCKETS;
+    if ((cache->buckets = calloc(cache->num_buckets, sizeof(CacheEntry *))) == NULL) {
+        perror("init_cache");
+        exit(1);
+    }
+    cache->count = 0;
+    cache->head = NULL;
+    cache->tail = NULL;
+    cache->bytes = 0;
+    cache->budget = budget;
+    cache->hits = 0;
+    cache->misses = 0;
+}
+
+static void unlink_lru(Cache *cache, CacheEntry *entry) {
+    if (entry->prev != NULL) {
+        entry->prev->next = entry->next;
+    } else {
+        cache->head = entry->next;
+    }
+    if (entry->next != NULL) {
+        entry->next->prev = entry->prev;
+    } else {
+        cache->tail = entry->prev;
+    }
+}
+
+static void push_lru(Cache *cache, CacheEntry *entry) {
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head != NULL) {
+        cache->head->prev = entry;
+    } else {
+        cache->tail = entry;
+    }
+    cache->head = entry;
+}
+
+/* Remove entry from the cache and free it.
+*/
+static void remove_entry(Cache *cache, CacheEntry *entry) {
+    CacheEntry **link = &cache->buckets[hash_key(entry->key) & (cache->num_buckets - 1)];
+    while (*link != entry) {
+        link = &(*link)->chain;
+    }
+    *link = entry->chain;
+    unlink_lru(cache, entry);
+    cache->count--;
+    cache->bytes -= entry->bytes;
+    free(entry->key);
+    free(entry->records);
+    free(entry);
+}
+
+/* Double the number of buckets, keeping at most one entry per bucket on
+* average.
+*/
+static void grow_cache(Cache *cache) {
+    unsigned int size = cache->num_buckets * 2;
+    CacheEntry **buckets = calloc(size, sizeof(CacheEntry *));
+    CacheEntry *entry, *next;
+    unsigned int i, b;
+    if (buckets == NULL) {
+        perror("grow_cache");
+        exit(1);
+    }
+    for (i = 0; i < cache->num_buckets; i++) {
+        for (entry = cache->buckets[i]; entry != NULL; entry = next) {
+            next = entry->chain;
+            b = hash_key(entry->key) & (size - 1);
+            entry->chain = buckets[b];
+            buckets[b] = entry;
+        }
+    }
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->num_buckets = size;
+}
+
+/* Return the entry for key if it was computed for this generation of
+* the indexes, and mark it most recently used; an entry left over from
+* an older generation is dropped.  Counts a hit or a miss.
+*/
+CacheEntry *cache_lookup(Cache *cache, char *key, unsigned long long generation) {
+    CacheEntry *entry = cache->buckets[hash_key(key) & (cache->num_buckets - 1)];
+    while (entry != NULL && strcmp(entry->key, key) != 0) {
+        entry = entry->chain;
+    }
+    if (entry != NULL && entry->generation != generation) {
+        remove_entry(cache, entry);
+        entry = NULL;
+    }
+    if (entry == NULL) {
+        cache->misses++;
+        return NULL;
+    }
+    cache->hits++;
+    unlink_lru(cache, entry);
+    push_lru(cache, entry);
+    return entry;
+}
+
+/* Store a copy of the records (terminated by a record with freq 0) for
+* key, evicting the least recently used entries to stay in the budget.
+* Results too large for the budget on their own are not cached.
+*/
+void cache_insert(Cache *cache, char *key, unsigned long long generation,
+                  FreqRecord *records, long total) {
+    CacheEntry *entry;
+    unsigned int b;
+    int n = 0;
+    while (records[n].freq != 0) {
+        n++;
+    }
+    size_t bytes = sizeof(CacheEntry) + strlen(key) + 1 + (n + 1) * sizeof(FreqRecord);
+    if (bytes > cache->budget) {
+        return;
+    }
+    b = hash_key(key) & (cache->num_buckets - 1);
+    for (entry = cache->buckets[b]; entry != NULL; entry = entry->chain) {
+        if (strcmp(entry->key, key) == 0) {
+            remove_entry(cache, entry);
+            break;
+        }
+    }
+    while (cache->bytes + bytes > cache->budget) {
+        remove_entry(cache, cache->tail);
+    }
+
+    if ((entry = malloc(sizeof(CacheEntry))) == NULL ||
+        (entry->key = strdup(key)) == NULL ||
+        (entry->records = malloc((n + 1) * sizeof(FreqRecord))) == NULL) {
+        perror("cache_insert");
+        exit(1);
+    }
+    memcpy(entry->records, records, (n + 1) * sizeof(FreqRecord));
+    entry->generation = generation;
+    entry->total = total;
+    entry->bytes = bytes;
+    b = hash_key(key) & (cache->num_buckets - 1);
+    entry->chain = cache->buckets[b];
+    cache->buckets[b] = entry;
+    push_lru(cache, entry);
+    cache->count++;
+    cache->bytes += bytes;
+    if (cache->count > cache->num_buckets) {
+        grow_cache(cache);
+    }
+}
+
+void free_cache(Cache *cache) {
+    while (cache->head != NULL) {
+        remove_entry(cache, cache->head);
+    }
+    free(cache->buckets);
+    cache->buckets = NULL;
+}
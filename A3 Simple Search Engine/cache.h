@@ -0,0 +1,36 @@
+// cache.h expects worker.h (for FreqRecord) to be included first.
+
+// An LRU cache of merged query results, kept by the query master.
+// Entries are looked up by the canonical form of a query (see
+// format_query) and are only valid for the generation of the indexes
+// they were computed from; the least recently used entries are dropped
+// to stay within a memory budget.
+
+typedef struct cache_entry {
+	char *key;
+	unsigned long long generation;
+	FreqRecord *records;            // terminated by a record with freq 0
+	long total;                     // number of matches before the top K
+	size_t bytes;
+	struct cache_entry *prev;       // LRU list, most recently used first
+	struct cache_entry *next;
+	struct cache_entry *chain;      // next entry in the same bucket
+} CacheEntry;
+
+typedef struct {
+	CacheEntry **buckets;
+	unsigned int num_buckets;
+	unsigned int count;
+	CacheEntry *head;
+	CacheEntry *tail;
+	size_t bytes;
+	size_t budget;
+	long hits;
+	long misses;
+} Cache;
+
+void init_cache(Cache *cache, size_t budget);
+CacheEntry *cache_lookup(Cache *cache, char *key, unsigned long long generation);
+void cache_insert(Cache *cache, char *key, unsigned long long generation,
+                  FreqRecord *records, long total);
+void free_cache(Cache *cache);
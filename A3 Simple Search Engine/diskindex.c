@@ -0,0 +1,786 @@
+/* Reading and writing the on-disk index.  The index is written once
+* from the sorted list of words built by the indexer, and is read by
+* mapping the file into memory: lookups binary search the block table
+* and decode a single block of terms in place, so loading an index does
+* not allocate anything per word.  See diskindex.h for the layout.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "freq_list.h"
+#include "diskindex.h"
+#include "normalize.h"
+
+/* Make room for n more bytes in a growable byte buffer.
+*/
+static unsigned char *reserve(unsigned char **buf, size_t *len, size_t *cap, size_t n) {
+	if(*len + n > *cap) {
+		size_t newcap = (*cap == 0) ? 4096 : *cap;
+		while(*len + n > newcap) {
+			newcap *= 2;
+		}
+		if((*buf = realloc(*buf, newcap)) == NULL) {
+			perror("reserve:");
+			exit(1);
+		}
+		*cap = newcap;
+	}
+	return *buf + *len;
+}
+
+/* Encode value as a varint at p and return the number of bytes used
+* (at most 10).
+*/
+static int put_varint(unsigned char *p, uint64_t value) {
+	int n = 0;
+	while(value >= 0x80) {
+		p[n++] = (unsigned char)(value | 0x80);
+		value >>= 7;
+	}
+	p[n++] = (unsigned char)value;
+	return n;
+}
+
+static const unsigned char *get_varint(const unsigned char *p, uint64_t *value) {
+	uint64_t v = 0;
+	int shift = 0;
+	while(*p & 0x80) {
+		v |= (uint64_t)(*p++ & 0x7f) << shift;
+		shift += 7;
+	}
+	*value = v | ((uint64_t)*p++ << shift);
+	return p;
+}
+
+/* Start writing an index of the files in files to listfile.  Only the
+* lengths of the files are used until the index is closed; files may
+* be empty for an index that is only merged into another one.
+*/
+void open_index_writer(IndexWriter *writer, char *listfile, int flags,
+                       FileTable *files) {
+	memset(writer, 0, sizeof(IndexWriter));
+	if((writer->fp = fopen(listfile, "w")) == NULL) {
+		perror("List file");
+		exit(1);
+	}
+	writer->listfile = listfile;
+	writer->files = files;
+	memcpy(writer->header.magic, INDEX_MAGIC, sizeof(writer->header.magic));
+	writer->header.version = INDEX_VERSION;
+	writer->header.flags = flags;
+	writer->header.normalize = NORMALIZE_CONFIG;
+}
+
+/* The number of words of file filenum, or 0 if the writer does not
+* know it.
+*/
+static uint32_t file_length(IndexWriter *writer, int filenum) {
+	if(filenum < writer->files->count) {
+		return writer->files->info[filenum].length;
+	}
+	return 0;
+}
+
+/* Append a term and its n postings (sorted by filenum) to the index.
+* If the index has INDEX_POSITIONS, positions holds the positions of
+* every posting in turn; otherwise it is not used.  Terms must be added
+* in sorted order; terms without postings are skipped.
+*/
+void add_index_term(IndexWriter *writer, char *word, Posting *postings, int n,
+                    int *positions) {
+	IndexHeader *header = &writer->header;
+	size_t start = writer->postings_len;
+	size_t first, positions_start;
+	SkipEntry skip = { 0, 0, 0, 0 };
+	uint32_t length;
+	int j, prev_position;
+	unsigned char *p;
+	int len = strlen(word);
+	int shared = 0;
+	int i, prev_filenum = 0, num_skips = 0;
+
+	if(n == 0) {
+		return;
+	}
+
+	if(header->num_terms % TERMS_PER_BLOCK == 0) {
+		if(header->num_blocks == writer->blocks_cap) {
+			writer->blocks_cap = (writer->blocks_cap == 0) ? 256 : writer->blocks_cap * 2;
+			writer->blocks = realloc(writer->blocks, writer->blocks_cap * sizeof(TermBlock));
+			if(writer->blocks == NULL) {
+				perror("add_index_term:");
+				exit(1);
+			}
+		}
+		writer->blocks[header->num_blocks].term_offset = writer->terms_len;
+		writer->blocks[header->num_blocks].postings_offset = writer->postings_len;
+		header->num_blocks++;
+		p = reserve(&writer->terms, &writer->terms_len, &writer->terms_cap, 1 + len);
+		*p++ = len;
+		memcpy(p, word, len);
+		writer->terms_len += 1 + len;
+	} else {
+		while(shared < len && word[shared] == writer->prev[shared]) {
+			shared++;
+		}
+		p = reserve(&writer->terms, &writer->terms_len, &writer->terms_cap, 2 + len - shared);
+		*p++ = shared;
+		*p++ = len - shared;
+		memcpy(p, word + shared, len - shared);
+		writer->terms_len += 2 + len - shared;
+	}
+	strncpy(writer->prev, word, MAXWORD - 1);
+	writer->prev[MAXWORD - 1] = '\0';
+
+	if(n > POSTINGS_PER_BLOCK) {
+		/* the skip table is filled in as the blocks are written */
+		num_skips = (n + POSTINGS_PER_BLOCK - 1) / POSTINGS_PER_BLOCK;
+		reserve(&writer->postings, &writer->postings_len, &writer->postings_cap,
+			num_skips * sizeof(SkipEntry));
+		writer->postings_len += num_skips * sizeof(SkipEntry);
+	}
+	first = writer->postings_len;
+	for(i = 0; i < n; i++) {
+		p = reserve(&writer->postings, &writer->postings_len, &writer->postings_cap, 20);
+		p += put_varint(p, postings[i].filenum - prev_filenum);
+		p += put_varint(p, postings[i].count);
+		writer->postings_len = p - writer->postings;
+		prev_filenum = postings[i].filenum;
+		if(num_skips == 0) {
+			continue;
+		}
+		length = file_length(writer, postings[i].filenum);
+		if(i % POSTINGS_PER_BLOCK == 0 || (uint32_t)postings[i].count > skip.max_count) {
+			skip.max_count = postings[i].count;
+		}
+		if(i % POSTINGS_PER_BLOCK == 0 || length < skip.min_length) {
+			skip.min_length = length;
+		}
+		if(i % POSTINGS_PER_BLOCK == POSTINGS_PER_BLOCK - 1 || i == n - 1) {
+			skip.last_filenum = postings[i].filenum;
+			skip.end = writer->postings_len - first;
+			memcpy(writer->postings + start +
+				(i / POSTINGS_PER_BLOCK) * sizeof(SkipEntry), &skip, sizeof(SkipEntry));
+		}
+	}
+	positions_start = writer->postings_len;
+	if(header->flags & INDEX_POSITIONS) {
+		for(i = 0; i < n; i++) {
+			prev_position = 0;
+			for(j = 0; j < postings[i].count; j++) {
+				p = reserve(&writer->postings, &writer->postings_len, &writer->postings_cap, 10);
+				p += put_varint(p, *positions - prev_position);
+				writer->postings_len = p - writer->postings;
+				prev_position = *positions++;
+			}
+		}
+	}
+
+	p = reserve(&writer->terms, &writer->terms_len, &writer->terms_cap, 30);
+	p += put_varint(p, n);
+	p += put_varint(p, positions_start - start);
+	if(header->flags & INDEX_POSITIONS) {
+		p += put_varint(p, writer->postings_len - positions_start);
+	}
+	writer->terms_len = p - writer->terms;
+
+	header->num_terms++;
+	header->num_postings += n;
+}
+
+/* Write the index out, with the information about its files, and close
+* it.
+*/
+void close_index_writer(IndexWriter *writer) {
+	IndexHeader *header = &writer->header;
+	FileTable *files = writer->files;
+	FILE *fp = writer->fp;
+	int i;
+
+	header->num_files = files->count;
+	header->names_hash = filenames_hash(files);
+	for(i = 0; i < files->count; i++) {
+		header->total_length += files->info[i].length;
+	}
+	header->files_offset = sizeof(IndexHeader);
+	header->blocks_offset = header->files_offset +
+		(uint64_t)files->count * sizeof(FileInfo);
+	header->terms_offset = header->blocks_offset +
+		(uint64_t)header->num_blocks * sizeof(TermBlock);
+	header->postings_offset = header->terms_offset + writer->terms_len;
+	header->end_offset = header->postings_offset + writer->postings_len;
+
+	fwrite(header, sizeof(IndexHeader), 1, fp);
+	fwrite(files->info, sizeof(FileInfo), files->count, fp);
+	fwrite(writer->blocks, sizeof(TermBlock), header->num_blocks, fp);
+	fwrite(writer->terms, 1, writer->terms_len, fp);
+	fwrite(writer->postings, 1, writer->postings_len, fp);
+	if(ferror(fp)) {
+		fprintf(stderr, "%s: write failed\n", writer->listfile);
+		exit(1);
+	}
+	if(fclose(fp)) {
+		perror("fclose");
+		exit(1);
+	}
+	free(writer->blocks);
+	free(writer->terms);
+	free(writer->postings);
+}
+
+/* Write the sorted list of words headed by head to listfile, with the
+* given flags.  Words left without postings (by indexer -u) are not
+* written.
+*/
+void write_index(char *listfile, Node *head, FileTable *files, int flags) {
+	IndexWriter writer;
+	Node *cur;
+
+	open_index_writer(&writer, listfile, flags, files);
+	for(cur = head; cur != NULL; cur = cur->next) {
+		add_index_term(&writer, cur->word, cur->postings, cur->num_postings,
+			cur->positions);
+	}
+	close_index_writer(&writer);
+}
+
+/* Map the index in listfile into memory and check that it is an index
+* of the version this program understands.  Returns 0, or -1 (after
+* saying why) if it can not be used; nothing is left mapped then.
+*/
+int map_index(char *listfile, DiskIndex *index) {
+	struct stat sbuf;
+	const IndexHeader *header;
+	int fd;
+
+	if((fd = open(listfile, O_RDONLY)) == -1) {
+		perror(listfile);
+		return -1;
+	}
+	if(fstat(fd, &sbuf) == -1) {
+		perror("fstat");
+		close(fd);
+		return -1;
+	}
+	if(sbuf.st_size < (off_t)sizeof(IndexHeader)) {
+		fprintf(stderr, "%s: not an index file\n", listfile);
+		close(fd);
+		return -1;
+	}
+	index->length = sbuf.st_size;
+	index->base = mmap(NULL, index->length, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(index->base == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+
+	header = index->base;
+	if(memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) != 0) {
+		fprintf(stderr, "%s: not an index file\n", listfile);
+		close_index(index);
+		return -1;
+	}
+	if(header->version != INDEX_VERSION) {
+		fprintf(stderr, "%s: index version %u, expected %u (re-run indexer)\n",
+			listfile, header->version, INDEX_VERSION);
+		close_index(index);
+		return -1;
+	}
+	if(header->blocks_offset != header->files_offset +
+	       (uint64_t)header->num_files * sizeof(FileInfo) ||
+	   header->terms_offset != header->blocks_offset +
+	       (uint64_t)header->num_blocks * sizeof(TermBlock) ||
+	   header->postings_offset < header->terms_offset ||
+	   header->end_offset < header->postings_offset ||
+	   header->end_offset != index->length) {
+		fprintf(stderr, "%s: truncated index\n", listfile);
+		close_index(index);
+		return -1;
+	}
+	index->header = header;
+	index->files = (const FileInfo *)((char *)index->base + header->files_offset);
+	index->blocks = (const TermBlock *)((char *)index->base + header->blocks_offset);
+	index->terms = (const unsigned char *)index->base + header->terms_offset;
+	index->postings = (const unsigned char *)index->base + header->postings_offset;
+	return 0;
+}
+
+/* Like map_index, but a program that can not go on without the index
+* exits.
+*/
+void open_index(char *listfile, DiskIndex *index) {
+	if(map_index(listfile, index) == -1) {
+		exit(1);
+	}
+}
+
+void close_index(DiskIndex *index) {
+	munmap(index->base, index->length);
+	index->base = NULL;
+}
+
+/* Position iter at the first term of the given block.
+*/
+void seek_terms(TermIter *iter, const DiskIndex *index, uint32_t block) {
+	iter->index = index;
+	iter->block = block;
+	iter->in_block = 0;
+	iter->word[0] = '\0';
+	if(block < index->header->num_blocks) {
+		iter->next = index->terms + index->blocks[block].term_offset;
+		iter->postings = index->postings + index->blocks[block].postings_offset;
+	}
+}
+
+/* Decode the next term into term.  Returns 0 when there are no more.
+*/
+int next_term(TermIter *iter, TermInfo *term) {
+	const unsigned char *p = iter->next;
+	uint64_t n, bytes, position_bytes = 0;
+	int shared = 0, len;
+
+	if((uint64_t)iter->block * TERMS_PER_BLOCK + iter->in_block >=
+	   iter->index->header->num_terms) {
+		return 0;
+	}
+	if(iter->in_block > 0) {
+		shared = *p++;
+	}
+	len = *p++;
+	memcpy(iter->word + shared, p, len);
+	iter->word[shared + len] = '\0';
+	p += len;
+	p = get_varint(p, &n);
+	p = get_varint(p, &bytes);
+	if(iter->index->header->flags & INDEX_POSITIONS) {
+		p = get_varint(p, &position_bytes);
+	}
+
+	memcpy(term->word, iter->word, shared + len + 1);
+	term->num_postings = n;
+	term->postings = iter->postings;
+	term->skips = NULL;
+	if(n > POSTINGS_PER_BLOCK) {
+		term->skips = iter->postings;
+		term->postings += num_posting_blocks(term) * sizeof(SkipEntry);
+	}
+	term->positions = (iter->index->header->flags & INDEX_POSITIONS) ?
+		iter->postings + bytes : NULL;
+
+	iter->next = p;
+	iter->postings += bytes + position_bytes;
+	if(++iter->in_block == TERMS_PER_BLOCK) {
+		iter->block++;
+		iter->in_block = 0;
+	}
+	return 1;
+}
+
+/* Compare word with the first term of a block, like strcmp.
+*/
+static int compare_block(const DiskIndex *index, uint32_t block, const char *word) {
+	const unsigned char *p = index->terms + index->blocks[block].term_offset;
+	int len = *p++;
+	int wlen = strlen(word);
+	int cmp = memcmp(p, word, len < wlen ? len : wlen);
+	if(cmp != 0) {
+		return cmp;
+	}
+	return len - wlen;
+}
+
+/* Return the block that would hold word: the last block whose first
+* term is not greater than word (block 0 if there is none).
+*/
+uint32_t find_block(const DiskIndex *index, const char *word) {
+	uint32_t lo = 0;
+	uint32_t hi = index->header->num_blocks;
+	uint32_t mid;
+
+	while(hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if(compare_block(index, mid, word) <= 0) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/* Look word up in the index: binary search the blocks, then decode the
+* one block that could hold it.  Returns 1 and fills in term if the word
+* is in the index, 0 otherwise.
+*/
+int find_term(const DiskIndex *index, const char *word, TermInfo *term) {
+	TermIter iter;
+	uint32_t block;
+	int cmp;
+
+	if(index->header->num_blocks == 0) {
+		return 0;
+	}
+	block = find_block(index, word);
+	seek_terms(&iter, index, block);
+	while(iter.block == block && next_term(&iter, term)) {
+		cmp = strcmp(term->word, word);
+		if(cmp == 0) {
+			return 1;
+		} else if(cmp > 0) {
+			break;
+		}
+	}
+	return 0;
+}
+
+void open_postings(PostingCursor *cursor, const TermInfo *term) {
+	cursor->next = term->postings;
+	cursor->remaining = term->num_postings;
+	cursor->filenum = 0;
+	cursor->first = term->postings;
+	cursor->skips = term->skips;
+	cursor->num_postings = term->num_postings;
+}
+
+/* Decode the next posting of a term.  Returns 0 when there are no more.
+*/
+int next_posting(PostingCursor *cursor, Posting *posting) {
+	uint64_t delta, count;
+	if(cursor->remaining == 0) {
+		return 0;
+	}
+	cursor->next = get_varint(cursor->next, &delta);
+	cursor->next = get_varint(cursor->next, &count);
+	cursor->filenum += delta;
+	cursor->remaining--;
+	posting->filenum = cursor->filenum;
+	posting->count = count;
+	return 1;
+}
+
+/* The number of blocks of the postings of term.
+*/
+uint32_t num_posting_blocks(const TermInfo *term) {
+	return (term->num_postings + POSTINGS_PER_BLOCK - 1) / POSTINGS_PER_BLOCK;
+}
+
+/* Read the skip table entry of the given block of the postings of a
+* term that has a skip table.
+*/
+void read_skip(const TermInfo *term, uint32_t block, SkipEntry *entry) {
+	memcpy(entry, term->skips + (size_t)block * sizeof(SkipEntry), sizeof(SkipEntry));
+}
+
+static uint32_t skip_last_filenum(const unsigned char *skips, uint32_t block) {
+	SkipEntry entry;
+	memcpy(&entry, skips + (size_t)block * sizeof(SkipEntry), sizeof(SkipEntry));
+	return entry.last_filenum;
+}
+
+/* Return the first of the num_blocks blocks of a skip table, from block
+* on, whose last file number is at least filenum, or num_blocks if there
+* is none.  The table is galloped through, so skipping far ahead costs
+* O(log distance).
+*/
+static uint32_t gallop_skips(const unsigned char *skips, uint32_t num_blocks,
+                             uint32_t block, int filenum) {
+	uint32_t lo = block, hi = block, step = 1, mid;
+
+	while(hi < num_blocks && skip_last_filenum(skips, hi) < (uint32_t)filenum) {
+		lo = hi + 1;
+		hi += step;
+		step *= 2;
+	}
+	if(hi > num_blocks) {
+		hi = num_blocks;
+	}
+	while(lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if(skip_last_filenum(skips, mid) < (uint32_t)filenum) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/* Return the first block, from block on, of the postings of a term with
+* a skip table whose last file number is at least filenum, or the
+* number of blocks if there is none.
+*/
+uint32_t find_posting_block(const TermInfo *term, uint32_t block, int filenum) {
+	return gallop_skips(term->skips, num_posting_blocks(term), block, filenum);
+}
+
+/* Decode the next posting of a term whose file number is at least
+* filenum into posting.  Blocks that end before filenum are skipped
+* without being decoded.  Returns 0 if there is no such posting.
+*/
+int skip_postings(PostingCursor *cursor, int filenum, Posting *posting) {
+	uint32_t num_blocks, block;
+	SkipEntry prev;
+
+	if(cursor->skips != NULL && cursor->remaining > 0) {
+		num_blocks = (cursor->num_postings + POSTINGS_PER_BLOCK - 1) / POSTINGS_PER_BLOCK;
+		block = (cursor->num_postings - cursor->remaining) / POSTINGS_PER_BLOCK;
+		if(skip_last_filenum(cursor->skips, block) < (uint32_t)filenum) {
+			block = gallop_skips(cursor->skips, num_blocks, block + 1, filenum);
+			if(block == num_blocks) {
+				cursor->remaining = 0;
+				return 0;
+			}
+			memcpy(&prev, cursor->skips + (size_t)(block - 1) * sizeof(SkipEntry),
+				sizeof(SkipEntry));
+			cursor->next = cursor->first + prev.end;
+			cursor->filenum = prev.last_filenum;
+			cursor->remaining = cursor->num_postings - block * POSTINGS_PER_BLOCK;
+		}
+	}
+	while(next_posting(cursor, posting)) {
+		if(posting->filenum >= filenum) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void open_positions(PositionCursor *cursor, const TermInfo *term) {
+	cursor->next = term->positions;
+}
+
+/* Decode the count positions of the next posting of a term.
+*/
+void next_positions(PositionCursor *cursor, int *positions, int count) {
+	uint64_t delta;
+	int i, position = 0;
+	for(i = 0; i < count; i++) {
+		cursor->next = get_varint(cursor->next, &delta);
+		position += delta;
+		positions[i] = position;
+	}
+}
+
+/* Print the index to standard output in a readable format.
+*/
+void display_index(DiskIndex *index, FileTable *files) {
+	TermIter iter;
+	TermInfo term;
+	PostingCursor cursor;
+	Posting p;
+
+	seek_terms(&iter, index, 0);
+	while(next_term(&iter, &term)) {
+		printf("%s\n", term.word);
+		open_postings(&cursor, &term);
+		while(next_posting(&cursor, &p)) {
+			printf("    %d %s ", p.count, files->names[p.filenum]);
+		}
+		printf("\n");
+	}
+}
+
+/* Copy every word of a mapped index into dict, so that it can be
+* updated and written out again.  A positional dict gets the positions
+* too, which the index must have.
+*/
+void load_dict(DiskIndex *index, Dict *dict) {
+	TermIter iter;
+	TermInfo term;
+	PostingCursor cursor;
+	PositionCursor positions;
+	Node *node;
+	int i = 0, total;
+
+	seek_terms(&iter, index, 0);
+	while(next_term(&iter, &term)) {
+		node = lookup_word(dict, term.word);
+		reserve_postings(dict, node, term.num_postings);
+		open_postings(&cursor, &term);
+		for(i = 0; next_posting(&cursor, &node->postings[i]); i++) {
+		}
+		node->num_postings = term.num_postings;
+		if(dict->positional && term.positions != NULL) {
+			for(i = 0, total = 0; i < node->num_postings; i++) {
+				total += node->postings[i].count;
+			}
+			reserve_positions(dict, node, total);
+			open_positions(&positions, &term);
+			for(i = 0, total = 0; i < node->num_postings; i++) {
+				next_positions(&positions, node->positions + total,
+					node->postings[i].count);
+				total += node->postings[i].count;
+			}
+			node->num_positions = total;
+		}
+	}
+}
+
+/* One input of merge_indexes: a run and its next term.
+*/
+typedef struct {
+	DiskIndex index;
+	TermIter iter;
+	TermInfo term;
+} MergeRun;
+
+/* A posting gathered by merge_indexes, and where its positions start.
+*/
+typedef struct {
+	Posting posting;
+	int start;
+} MergePosting;
+
+static int compare_merged(const void *a, const void *b) {
+	return ((const MergePosting *)a)->posting.filenum -
+		((const MergePosting *)b)->posting.filenum;
+}
+
+/* Restore the heap order of the runs (smallest term first) below
+* position i.
+*/
+static void sift_runs(MergeRun **heap, int n, int i) {
+	MergeRun *run = heap[i];
+	int child;
+
+	while((child = 2 * i + 1) < n) {
+		if(child + 1 < n && strcmp(heap[child + 1]->term.word, heap[child]->term.word) < 0) {
+			child++;
+		}
+		if(strcmp(heap[child]->term.word, run->term.word) >= 0) {
+			break;
+		}
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = run;
+}
+
+/* Make room for n elements of the given size in a growable array.
+*/
+static void *grow_array(void *array, int *capacity, int n, size_t size) {
+	if(n > *capacity) {
+		*capacity = 2 * n;
+		if((array = realloc(array, (size_t)*capacity * size)) == NULL) {
+			perror("merge_indexes:");
+			exit(1);
+		}
+	}
+	return array;
+}
+
+/* Merge the num_runs index files in runs, whose postings all refer to
+* the same file table and which have the same flags, into one index in
+* listfile.  This is a k-way merge on the terms: a heap holds the next
+* term of every run, and the postings of a term found in several runs
+* are combined, so only one term's postings are held in memory at a
+* time.  The runs are normally written in file order, in which case
+* their postings are simply concatenated; runs written by concurrent
+* threads are sorted by file.  All the words of a file are in the same
+* run, so the positions of a file never have to be merged.
+*/
+void merge_indexes(char *listfile, char **runs, int num_runs, FileTable *files) {
+	IndexWriter writer;
+	MergeRun *inputs;
+	MergeRun **heap;
+	PostingCursor cursor;
+	PositionCursor position_cursor;
+	MergePosting *gathered = NULL;
+	Posting *postings = NULL;
+	int *positions = NULL, *reordered = NULL;
+	char word[MAXWORD];
+	int max_gathered = 0, max_postings = 0, max_positions = 0, max_reordered = 0;
+	int n, i, j, k, sorted, num_heap = 0, num_positions, flags = 0;
+
+	inputs = malloc((num_runs + 1) * sizeof(MergeRun));
+	heap = malloc((num_runs + 1) * sizeof(MergeRun *));
+	if(inputs == NULL || heap == NULL) {
+		perror("merge_indexes:");
+		exit(1);
+	}
+	for(i = 0; i < num_runs; i++) {
+		open_index(runs[i], &inputs[i].index);
+		flags = inputs[i].index.header->flags;
+		seek_terms(&inputs[i].iter, &inputs[i].index, 0);
+		if(next_term(&inputs[i].iter, &inputs[i].term)) {
+			heap[num_heap++] = &inputs[i];
+		}
+	}
+	for(i = num_heap / 2 - 1; i >= 0; i--) {
+		sift_runs(heap, num_heap, i);
+	}
+
+	open_index_writer(&writer, listfile, flags, files);
+	while(num_heap > 0) {
+		strcpy(word, heap[0]->term.word);
+		n = 0;
+		num_positions = 0;
+		sorted = 1;
+		while(num_heap > 0 && strcmp(heap[0]->term.word, word) == 0) {
+			MergeRun *run = heap[0];
+			gathered = grow_array(gathered, &max_gathered,
+				n + run->term.num_postings, sizeof(MergePosting));
+			open_postings(&cursor, &run->term);
+			open_positions(&position_cursor, &run->term);
+			for(i = n; next_posting(&cursor, &gathered[i].posting); i++) {
+				gathered[i].start = num_positions;
+				if(flags & INDEX_POSITIONS) {
+					positions = grow_array(positions, &max_positions,
+						num_positions + gathered[i].posting.count, sizeof(int));
+					next_positions(&position_cursor, positions + num_positions,
+						gathered[i].posting.count);
+					num_positions += gathered[i].posting.count;
+				}
+			}
+			if(n > 0 && gathered[n].posting.filenum <= gathered[n - 1].posting.filenum) {
+				sorted = 0;
+			}
+			n = i;
+			if(!next_term(&run->iter, &run->term)) {
+				heap[0] = heap[--num_heap];
+			}
+			if(num_heap > 0) {
+				sift_runs(heap, num_heap, 0);
+			}
+		}
+		if(!sorted) {
+			qsort(gathered, n, sizeof(MergePosting), compare_merged);
+		}
+		postings = grow_array(postings, &max_postings, n, sizeof(Posting));
+		if(!sorted && (flags & INDEX_POSITIONS)) {
+			reordered = grow_array(reordered, &max_reordered, num_positions, sizeof(int));
+		}
+		for(i = 0, j = 0, k = 0; i < n; i++) {
+			if(!sorted && (flags & INDEX_POSITIONS)) {
+				memcpy(reordered + k, positions + gathered[i].start,
+					gathered[i].posting.count * sizeof(int));
+				k += gathered[i].posting.count;
+			}
+			if(j > 0 && postings[j - 1].filenum == gathered[i].posting.filenum) {
+				postings[j - 1].count += gathered[i].posting.count;
+			} else {
+				postings[j++] = gathered[i].posting;
+			}
+		}
+		add_index_term(&writer, word, postings, j,
+			(!sorted && (flags & INDEX_POSITIONS)) ? reordered : positions);
+	}
+	close_index_writer(&writer);
+
+	for(i = 0; i < num_runs; i++) {
+		close_index(&inputs[i].index);
+	}
+	free(gathered);
+	free(postings);
+	free(positions);
+	free(reordered);
+	free(inputs);
+	free(heap);
+}
@@ -0,0 +1,177 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#define INDEX_MAGIC "B09INDEX"
+#define INDEX_VERSION 7
+
+#define INDEX_POSITIONS 1   // flag: the index records word positions
+
+#define TERMS_PER_BLOCK 16
+#define POSTINGS_PER_BLOCK 128
+
+/* Layout of an index file (all integers in host byte order):
+*
+*   IndexHeader
+*   FileInfo[num_files]      for each file, the number of words indexed
+*                            (used to normalize ranking scores) and the
+*                            mtime, size and hash used by indexer -u
+*   TermBlock[num_blocks]    where each block of terms starts
+*   term data                the sorted terms, front coded in blocks
+*   postings data            the postings of every term, compressed
+*
+* Terms are grouped in blocks of TERMS_PER_BLOCK.  The first term of a
+* block is stored in full:
+*     length byte, characters
+* and every other term as the number of leading characters it shares
+* with the previous term and the rest of it:
+*     shared byte, suffix length byte, suffix characters
+* Each term is followed by two varints: its number of postings and the
+* size in bytes of its postings, and in an index with INDEX_POSITIONS
+* in its flags a third: the size in bytes of its positions, which are
+* stored right after its postings.  The TermBlock table can be binary
+* searched on the first term of each block, after which at most one
+* block has to be decoded.
+*
+* A term's postings are pairs of varints: the difference between its
+* file number and the previous posting's (the first posting stores the
+* file number itself), and the count.  A varint holds 7 bits per byte,
+* least significant first, with the high bit set on all but the last.
+* A term with more than POSTINGS_PER_BLOCK postings has them split into
+* blocks of that many, with a skip table of one SkipEntry per block in
+* front of them (counted in the size of its postings): a reader can go
+* straight to the block that may hold a file number, and knows the
+* largest count and the shortest file in a block without decoding it.
+* A term's positions follow its postings: for each posting in turn, the
+* count token offsets of the term in that file, each as a varint
+* difference from the previous one (the first one as is).
+*
+* The file is mapped into memory and used in place by the workers.
+*/
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_terms;
+    uint32_t num_files;
+    uint32_t num_blocks;
+    uint32_t flags;
+    uint32_t normalize;     // NORMALIZE_CONFIG of the indexer
+    uint64_t names_hash;    // filenames_hash of the file names written
+                            // with the index, to tell a matching pair
+    uint64_t num_postings;
+    uint64_t total_length;
+    uint64_t files_offset;
+    uint64_t blocks_offset;
+    uint64_t terms_offset;
+    uint64_t postings_offset;
+    uint64_t end_offset;
+} IndexHeader;
+
+typedef struct {
+    uint64_t term_offset;       // from the start of the term data
+    uint64_t postings_offset;   // of the block's first term, from the
+                                // start of the postings data
+} TermBlock;
+
+/* An entry of the skip table of a term's postings.  Posting deltas run
+* on across blocks, so a block is decoded from the file number of the
+* previous block's last posting.
+*/
+typedef struct {
+    uint32_t last_filenum;  // file number of the block's last posting
+    uint32_t end;           // offset of the end of the block from the
+                            // term's first posting
+    uint32_t max_count;     // the largest count in the block
+    uint32_t min_length;    // the fewest words of a file in the block
+} SkipEntry;
+
+/* An index file mapped into memory.
+*/
+typedef struct {
+    void *base;
+    size_t length;
+    const IndexHeader *header;
+    const FileInfo *files;
+    const TermBlock *blocks;
+    const unsigned char *terms;
+    const unsigned char *postings;
+} DiskIndex;
+
+/* A term decoded from the index.
+*/
+typedef struct {
+    char word[MAXWORD];
+    uint32_t num_postings;
+    const unsigned char *postings;  // encoded, see next_posting
+    const unsigned char *skips;     // SkipEntry[], see read_skip, or NULL
+    const unsigned char *positions; // see next_positions, or NULL
+} TermInfo;
+
+/* Walks the terms of an index in order.
+*/
+typedef struct {
+    const DiskIndex *index;
+    uint32_t block;                 // block of the next term
+    uint32_t in_block;              // position of the next term in it
+    const unsigned char *next;      // encoded next term
+    const unsigned char *postings;  // postings of the next term
+    char word[MAXWORD];             // the previous term
+} TermIter;
+
+/* Decodes the postings of one term.
+*/
+typedef struct {
+    const unsigned char *next;
+    uint32_t remaining;
+    int filenum;
+    const unsigned char *first;     // the term's first posting
+    const unsigned char *skips;     // and its skip table, or NULL
+    uint32_t num_postings;
+} PostingCursor;
+
+/* Decodes the positions of one term, a posting at a time.
+*/
+typedef struct {
+    const unsigned char *next;
+} PositionCursor;
+
+/* Builds an index file one term at a time, in sorted order.
+*/
+typedef struct {
+    FILE *fp;
+    char *listfile;
+    FileTable *files;               // for the lengths in the skip tables
+    IndexHeader header;
+    unsigned char *terms;
+    size_t terms_len, terms_cap;
+    unsigned char *postings;
+    size_t postings_len, postings_cap;
+    TermBlock *blocks;
+    uint32_t blocks_cap;
+    char prev[MAXWORD];
+} IndexWriter;
+
+void open_index_writer(IndexWriter *writer, char *listfile, int flags,
+                       FileTable *files);
+void add_index_term(IndexWriter *writer, char *word, Posting *postings, int n,
+                    int *positions);
+void close_index_writer(IndexWriter *writer);
+void write_index(char *listfile, Node *head, FileTable *files, int flags);
+void merge_indexes(char *listfile, char **runs, int num_runs, FileTable *files);
+
+int map_index(char *listfile, DiskIndex *index);
+void open_index(char *listfile, DiskIndex *index);
+void close_index(DiskIndex *index);
+void seek_terms(TermIter *iter, const DiskIndex *index, uint32_t block);
+int next_term(TermIter *iter, TermInfo *term);
+uint32_t find_block(const DiskIndex *index, const char *word);
+int find_term(const DiskIndex *index, const char *word, TermInfo *term);
+void open_postings(PostingCursor *cursor, const TermInfo *term);
+int next_posting(PostingCursor *cursor, Posting *posting);
+uint32_t num_posting_blocks(const TermInfo *term);
+void read_skip(const TermInfo *term, uint32_t block, SkipEntry *entry);
+uint32_t find_posting_block(const TermInfo *term, uint32_t block, int filenum);
+int skip_postings(PostingCursor *cursor, int filenum, Posting *posting);
+void open_positions(PositionCursor *cursor, const TermInfo *term);
+void next_positions(PositionCursor *cursor, int *positions, int count);
+void display_index(DiskIndex *index, FileTable *files);
+void load_dict(DiskIndex *index, Dict *dict);
@@ -0,0 +1,371 @@
+/* In-process query evaluation.  Every index is mapped once and shared
+* read-only, and a query is run across the shards by a fixed pool of
+* threads: each thread starts with its own share of the shards and,
+* once it runs out, steals shards from the others, so one large shard
+* does not leave the other threads idle.  Each thread keeps its best
+* records in its own TopK, and these are merged at the end.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "freq_list.h"
+#include "diskindex.h"
+#include "search.h"
+#include "worker.h"
+#include "topk.h"
+#include "engine.h"
+
+typedef struct {
+    Shard *shards;
+    int num_shards;
+    int next;                       // the next shard to load
+    pthread_mutex_t lock;
+} ShardLoader;
+
+static void *load_thread(void *arg) {
+    ShardLoader *loader = arg;
+    int i;
+    while (1) {
+        pthread_mutex_lock(&loader->lock);
+        i = loader->next++;
+        pthread_mutex_unlock(&loader->lock);
+        if (i >= loader->num_shards) {
+            return NULL;
+        }
+        load_index(loader->shards[i].dir, &loader->shards[i].index,
+                   &loader->shards[i].files);
+    }
+}
+
+/* Map the index of every subdirectory of startdir that has one, using
+* up to num_threads threads so that the file tables of many shards are
+* read at the same time.  Returns the shards and stores their number in
+* num_shards.
+*/
+Shard *load_shards(char *startdir, int *num_shards, int num_threads) {
+    char path[PATHLENGTH];
+    struct dirent *dp;
+    struct stat sbuf;
+    Shard *shards = NULL;
+    int max_shards = 0;
+    ShardLoader loader;
+    pthread_t *threads;
+    DIR *dirp;
+    int i;
+
+    if ((dirp = opendir(startdir)) == NULL) {
+        perror(startdir);
+        exit(1);
+    }
+    *num_shards = 0;
+    while ((dp = readdir(dirp)) != NULL) {
+        if (strcmp(dp->d_name, ".") == 0 || strcmp(dp->d_name, "..") == 0 ||
+            strcmp(dp->d_name, ".svn") == 0) {
+            continue;
+        }
+        if (snprintf(path, PATHLENGTH, "%s/%s", startdir, dp->d_name)
+            >= PATHLENGTH) {
+            fprintf(stderr, "%s/%s: path too long\n", startdir, dp->d_name);
+            continue;
+        }
+        if (stat(path, &sbuf) == -1 || !S_ISDIR(sbuf.st_mode)) {
+            continue;
+        }
+        if (index_generation(path) == 0) {
+            fprintf(stderr, "%s has no index, skipping it\n", path);
+            continue;
+        }
+        if (*num_shards == max_shards) {
+            max_shards = (max_shards == 0) ? 16 : max_shards * 2;
+            if ((shards = realloc(shards, max_shards * sizeof(Shard))) == NULL) {
+                perror("ERROR: Malloc failed");
+                exit(1);
+            }
+        }
+        Shard *shard = &shards[(*num_shards)++];
+        strcpy(shard->dir, path);
+        shard->generation = index_generation(path);
+    }
+    closedir(dirp);
+
+    loader.shards = shards;
+    loader.num_shards = *num_shards;
+    loader.next = 0;
+    pthread_mutex_init(&loader.lock, NULL);
+    if (num_threads > *num_shards) {
+        num_threads = *num_shards;
+    }
+    if (num_threads <= 1) {
+        load_thread(&loader);
+    } else {
+        if ((threads = malloc(num_threads * sizeof(pthread_t))) == NULL) {
+            perror("ERROR: Malloc failed");
+            exit(1);
+        }
+        for (i = 0; i < num_threads; i++) {
+            if (pthread_create(&threads[i], NULL, load_thread, &loader) != 0) {
+                fprintf(stderr, "pthread_create failed\n");
+                exit(1);
+            }
+        }
+        for (i = 0; i < num_threads; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        free(threads);
+    }
+    pthread_mutex_destroy(&loader.lock);
+    return shards;
+}
+
+/* Map the shard's index again if the indexer has replaced it.  Returns
+* 1 if it was reloaded.  If the new index can not be loaded (see
+* reload_index) the shard keeps the one it has, and the next call tries
+* again.  No query may be using the shard meanwhile.
+*/
+int reload_shard(Shard *shard, Stats *stats) {
+    unsigned long long current = index_generation(shard->dir);
+    unsigned long long start;
+    if (current == 0 || current == shard->generation) {
+        return 0;
+    }
+    start = stats_clock();
+    if (reload_index(shard->dir, &shard->index, &shard->files) == -1) {
+        return 0;
+    }
+    shard->generation = current;
+    stop_timer(stats, TIMER_LOAD, start);
+    stats->counters[STAT_INDEX_LOADS]++;
+    return 1;
+}
+
+void free_shards(Shard *shards, int num_shards) {
+    int i;
+    for (i = 0; i < num_shards; i++) {
+        close_index(&shards[i].index);
+        free_filenames(&shards[i].files);
+    }
+    free(shards);
+}
+
+/* Take the next shard to search from the back of a thread's own queue,
+* or -1 if it is empty.
+*/
+static int pop_task(TaskQueue *queue) {
+    int task = -1;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->tail > queue->head) {
+        task = queue->tasks[--queue->tail];
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return task;
+}
+
+/* Steal a shard from the front of another thread's queue.
+*/
+static int steal_task(TaskQueue *queue) {
+    int task = -1;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->tail > queue->head) {
+        task = queue->tasks[queue->head++];
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return task;
+}
+
+typedef struct {
+    Engine *engine;
+    int id;
+} EngineThread;
+
+static void *engine_thread(void *arg) {
+    EngineThread *self = arg;
+    Engine *engine = self->engine;
+    int id = self->id;
+    TopK *results = &engine->results[id];
+    Stats *stats = &engine->stats[id];
+    FreqRecord *frp;
+    unsigned long long start;
+    long seen = 0;
+    int task, i, n;
+
+    free(self);
+    while (1) {
+        pthread_mutex_lock(&engine->lock);
+        while (engine->job == seen && !engine->stopping) {
+            pthread_cond_wait(&engine->start, &engine->lock);
+        }
+        if (engine->stopping) {
+            pthread_mutex_unlock(&engine->lock);
+            return NULL;
+        }
+        seen = engine->job;
+        pthread_mutex_unlock(&engine->lock);
+
+        while (1) {
+            if ((task = pop_task(&engine->queues[id])) == -1) {
+                // own queue empty: try the others, starting with the next
+                for (i = 1; i < engine->num_threads && task == -1; i++) {
+                    task = steal_task(&engine->queues[(id + i) % engine->num_threads]);
+                }
+                if (task == -1) {
+                    break;
+                }
+            }
+            start = stats_clock();
+            Shard *shard = &engine->shards[task];
+            if (engine->exact) {
+                frp = get_term(&shard->index, &shard->files, engine->query,
+                               engine->flags);
+            } else {
+                frp = get_query(&shard->index, &shard->files, engine->query,
+                                engine->flags, results->capacity);
+            }
+            for (n = 0; frp[n].freq != 0; n++) {
+                topk_add(results, &frp[n]);
+            }
+            free(frp);
+            stop_timer(stats, TIMER_LOOKUP, start);
+            stats->counters[STAT_RECORDS] += n;
+        }
+
+        pthread_mutex_lock(&engine->lock);
+        if (--engine->busy == 0) {
+            pthread_cond_signal(&engine->done);
+        }
+        pthread_mutex_unlock(&engine->lock);
+    }
+}
+
+/* Start a pool of num_threads threads to query the shards, keeping the
+* best max_results records of each query.
+*/
+void start_engine(Engine *engine, Shard *shards, int num_shards,
+                  int num_threads, int max_results) {
+    EngineThread *self;
+    int i;
+
+    engine->shards = shards;
+    engine->num_shards = num_shards;
+    engine->num_threads = num_threads;
+    engine->job = 0;
+    engine->busy = 0;
+    engine->stopping = 0;
+    engine->threads = malloc(num_threads * sizeof(pthread_t));
+    engine->queues = malloc(num_threads * sizeof(TaskQueue));
+    engine->results = malloc(num_threads * sizeof(TopK));
+    engine->stats = malloc(num_threads * sizeof(Stats));
+    if (engine->threads == NULL || engine->queues == NULL ||
+        engine->results == NULL || engine->stats == NULL) {
+        perror("ERROR: Malloc failed");
+        exit(1);
+    }
+    pthread_mutex_init(&engine->lock, NULL);
+    pthread_cond_init(&engine->start, NULL);
+    pthread_cond_init(&engine->done, NULL);
+    for (i = 0; i < num_threads; i++) {
+        if ((engine->queues[i].tasks = malloc((num_shards + 1) * sizeof(int))) == NULL) {
+            perror("ERROR: Malloc failed");
+            exit(1);
+        }
+        engine->queues[i].head = engine->queues[i].tail = 0;
+        pthread_mutex_init(&engine->queues[i].lock, NULL);
+        init_topk(&engine->results[i], max_results);
+        init_stats(&engine->stats[i]);
+    }
+    for (i = 0; i < num_threads; i++) {
+        if ((self = malloc(sizeof(EngineThread))) == NULL) {
+            perror("ERROR: Malloc failed");
+            exit(1);
+        }
+        self->engine = engine;
+        self->id = i;
+        if (pthread_create(&engine->threads[i], NULL, engine_thread, self) != 0) {
+            fprintf(stderr, "pthread_create failed\n");
+            exit(1);
+        }
+    }
+}
+
+/* Run query (a query, or with exact a term as get_term takes it) on
+* every shard and leave the best records in results (which must have
+* been reset).  The shards are dealt out to the threads round robin,
+* and the threads balance the load by stealing.
+*/
+static void run_job(Engine *engine, char *query, int flags, int exact,
+                    TopK *results) {
+    int i, j;
+
+    pthread_mutex_lock(&engine->lock);
+    strncpy(engine->query, query, MAXLINE);
+    engine->query[MAXLINE - 1] = '\0';
+    engine->flags = flags;
+    engine->exact = exact;
+    for (i = 0; i < engine->num_threads; i++) {
+        engine->queues[i].head = engine->queues[i].tail = 0;
+        reset_topk(&engine->results[i]);
+    }
+    for (i = 0; i < engine->num_shards; i++) {
+        TaskQueue *queue = &engine->queues[i % engine->num_threads];
+        queue->tasks[queue->tail++] = i;
+    }
+    engine->busy = engine->num_threads;
+    engine->job++;
+    pthread_cond_broadcast(&engine->start);
+    while (engine->busy > 0) {
+        pthread_cond_wait(&engine->done, &engine->lock);
+    }
+    pthread_mutex_unlock(&engine->lock);
+
+    for (i = 0; i < engine->num_threads; i++) {
+        TopK *part = &engine->results[i];
+        for (j = 0; j < part->size; j++) {
+            topk_add(results, &part->heap[j]);
+        }
+        // every record offered to a thread counts as a match
+        results->total += part->total - part->size;
+    }
+    engine->stats[0].counters[STAT_LOOKUPS]++;
+}
+
+void engine_query(Engine *engine, char *query, int flags, TopK *results) {
+    run_job(engine, query, flags, 0, results);
+}
+
+/* Look up a normalized word, as a batch does (see get_term).
+*/
+void engine_term(Engine *engine, char *word, int flags, TopK *results) {
+    run_job(engine, word, flags, 1, results);
+}
+
+/* Add the counters of every engine thread to stats.
+*/
+void engine_stats(Engine *engine, Stats *stats) {
+    int i;
+    pthread_mutex_lock(&engine->lock);
+    for (i = 0; i < engine->num_threads; i++) {
+        add_stats(stats, &engine->stats[i]);
+    }
+    pthread_mutex_unlock(&engine->lock);
+}
+
+void stop_engine(Engine *engine) {
+    int i;
+    pthread_mutex_lock(&engine->lock);
+    engine->stopping = 1;
+    pthread_cond_broadcast(&engine->start);
+    pthread_mutex_unlock(&engine->lock);
+    for (i = 0; i < engine->num_threads; i++) {
+        pthread_join(engine->threads[i], NULL);
+        free(engine->queues[i].tasks);
+        pthread_mutex_destroy(&engine->queues[i].lock);
+        free_topk(&engine->results[i]);
+    }
+    free(engine->threads);
+    free(engine->queues);
+    free(engine->results);
+    free(engine->stats);
+}
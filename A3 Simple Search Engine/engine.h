@@ -0,0 +1,54 @@
+// engine.h expects freq_list.h, diskindex.h, search.h, worker.h and
+// topk.h to be included first, and <pthread.h>.
+
+// The index of one subdirectory, mapped into this process and shared
+// read-only by every thread that queries it.
+
+typedef struct {
+	char dir[PATHLENGTH];
+	DiskIndex index;
+	FileTable files;
+	unsigned long long generation;  // see index_generation
+} Shard;
+
+// A deque of shard numbers.  Its owner takes work from the back; idle
+// threads steal from the front.
+
+typedef struct {
+	int *tasks;
+	int head;
+	int tail;
+	pthread_mutex_t lock;
+} TaskQueue;
+
+// An in-process query engine: a fixed pool of threads that evaluates
+// one query at a time across all the shards.
+
+typedef struct {
+	Shard *shards;
+	int num_shards;
+	int num_threads;
+	pthread_t *threads;
+	TaskQueue *queues;              // one per thread
+	TopK *results;                  // one per thread
+	Stats *stats;                   // one per thread
+	char query[MAXLINE];            // the query being evaluated
+	int flags;
+	int exact;                      // query is one normalized term
+	long job;                       // number of the current query
+	int busy;                       // threads still working on it
+	int stopping;
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+} Engine;
+
+Shard *load_shards(char *startdir, int *num_shards, int num_threads);
+int reload_shard(Shard *shard, Stats *stats);
+void free_shards(Shard *shards, int num_shards);
+void start_engine(Engine *engine, Shard *shards, int num_shards,
+                  int num_threads, int max_results);
+void engine_query(Engine *engine, char *query, int flags, TopK *results);
+void engine_term(Engine *engine, char *word, int flags, TopK *results);
+void engine_stats(Engine *engine, Stats *stats);
+void stop_engine(Engine *engine);
@@ -1,8 +1,11 @@
 /* The functions operate on a linked list of words.  Each element of the
-* list contains a word, and an array that stores the frequency of the
-* word for each file in which the word is found  The name of the file that
-* is analyzed is stored in an array of file names.  The array in a
-* linked list node is a parallel array to the array of file names.
+* list contains a word, and a postings list that stores the frequency of
+* the word for each file in which the word is found.  The name of the file
+* that is analyzed is stored in a table of file names, and each posting
+* refers to a file by its index in that table.
+* While indexing, a hash table (Dict) maps each word to its node so that
+* adding a word does not require walking the list.  Everything the
+* dictionary holds is allocated from its arena and freed with it.
 */
 
 #include <stdio.h>
@@ -10,245 +13,643 @@
 #include <stdlib.h>
 
 #include "freq_list.h"
-int num_words = 0;
+#include "diskindex.h"
+#include "tokenize.h"
 
-/* Allocate and initialize a new node for the list.
+/* Allocate and initialize a new node for the list in the arena of
+* dict.  The word is truncated to MAXWORD-1 characters.  If count is 0
+* the node starts with an empty postings list.
 */
-Node *create_node(char *word, int count, int filenum) {
-	Node *newnode;
-	if((newnode= malloc(sizeof(Node))) == NULL) {
-		perror("create_node:");
+Node *create_node(Dict *dict, char *word, int count, int filenum) {
+	Node *newnode = arena_alloc(&dict->arena, sizeof(Node));
+
+	dict->stats.counters[STAT_NODES]++;
+	newnode->word = arena_strdup(&dict->arena, word, strnlen(word, MAXWORD - 1));
+	newnode->num_postings = 0;
+	newnode->max_postings = 0;
+	newnode->postings = NULL;
+	newnode->num_positions = 0;
+	newnode->max_positions = 0;
+	newnode->positions = NULL;
+	newnode->next = NULL;
+	if(count > 0) {
+		add_posting(dict, newnode, filenum, count);
+	}
+	return newnode;
+}
+
+/* Postings and positions arrays are allocated from the arena in sizes
+* that are a power of two bytes.  An array that is outgrown goes on the
+* free list for its size in dict->spare, and is handed out again before
+* new arena space is used, so growing a list does not leave holes in
+* the arena.  Return an array of at least *bytes bytes, and set *bytes
+* to its actual size.
+*/
+static void *alloc_chunk(Dict *dict, size_t *bytes) {
+	void *p;
+	int k = 3;
+
+	/* every chunk must be able to hold the link to the next one */
+	while(((size_t)1 << k) < *bytes) {
+		k++;
+	}
+	*bytes = (size_t)1 << k;
+	if((p = dict->spare[k]) != NULL) {
+		memcpy(&dict->spare[k], p, sizeof(void *));
+		return p;
+	}
+	return arena_alloc(&dict->arena, *bytes);
+}
+
+/* Put an array of the given size (a size returned by alloc_chunk) on
+* the free list for its size.
+*/
+static void release_chunk(Dict *dict, void *p, size_t bytes) {
+	int k = 3;
+
+	if(p == NULL || bytes == 0) {
+		return;
+	}
+	while(((size_t)2 << k) <= bytes) {
+		k++;
+	}
+	memcpy(p, &dict->spare[k], sizeof(void *));
+	dict->spare[k] = p;
+}
+
+/* Return an array with room for at least *capacity postings, and set
+* *capacity to its actual size.
+*/
+static Posting *alloc_postings(Dict *dict, int *capacity) {
+	size_t bytes = *capacity * sizeof(Posting);
+	Posting *p = alloc_chunk(dict, &bytes);
+	*capacity = bytes / sizeof(Posting);
+	return p;
+}
+
+static void release_postings(Dict *dict, Posting *p, int capacity) {
+	release_chunk(dict, p, capacity * sizeof(Posting));
+}
+
+static int *alloc_positions(Dict *dict, int *capacity) {
+	size_t bytes = *capacity * sizeof(int);
+	int *p = alloc_chunk(dict, &bytes);
+	*capacity = bytes / sizeof(int);
+	return p;
+}
+
+static void release_positions(Dict *dict, int *p, int capacity) {
+	release_chunk(dict, p, capacity * sizeof(int));
+}
+
+/* Make room in the postings of node for at least n postings.
+*/
+void reserve_postings(Dict *dict, Node *node, int n) {
+	Posting *p;
+	int capacity = n;
+
+	if(n <= node->max_postings) {
+		return;
+	}
+	p = alloc_postings(dict, &capacity);
+	memcpy(p, node->postings, node->num_postings * sizeof(Posting));
+	release_postings(dict, node->postings, node->max_postings);
+	node->postings = p;
+	node->max_postings = capacity;
+}
+
+/* Make room in the positions of node for at least n positions.
+*/
+void reserve_positions(Dict *dict, Node *node, int n) {
+	int *p;
+	int capacity = n;
+
+	if(n <= node->max_positions) {
+		return;
+	}
+	p = alloc_positions(dict, &capacity);
+	memcpy(p, node->positions, node->num_positions * sizeof(int));
+	release_positions(dict, node->positions, node->max_positions);
+	node->positions = p;
+	node->max_positions = capacity;
+}
+
+/* Add count occurrences in file filenum to the postings of node.
+* Files are normally indexed in order, so the common cases are bumping
+* the last posting or appending a new one; otherwise the posting is
+* found (or inserted) with a binary search.
+*/
+void add_posting(Dict *dict, Node *node, int filenum, int count) {
+	int lo, hi, mid;
+	Posting *last;
+
+	if(node->num_postings > 0) {
+		last = &node->postings[node->num_postings - 1];
+		if(last->filenum == filenum) {
+			last->count += count;
+			return;
+		}
+	}
+
+	lo = 0;
+	hi = node->num_postings;
+	if(hi > 0 && node->postings[hi - 1].filenum > filenum) {
+		while(lo < hi) {
+			mid = (lo + hi) / 2;
+			if(node->postings[mid].filenum < filenum) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+		if(node->postings[lo].filenum == filenum) {
+			node->postings[lo].count += count;
+			return;
+		}
+	} else {
+		lo = node->num_postings;
+	}
+
+	reserve_postings(dict, node, node->num_postings + 1);
+	memmove(&node->postings[lo + 1], &node->postings[lo],
+		(node->num_postings - lo) * sizeof(Posting));
+	node->postings[lo].filenum = filenum;
+	node->postings[lo].count = count;
+	node->num_postings++;
+}
+
+#define DICT_INITIAL_SIZE 1024
+
+/* FNV-1a hash of a null terminated string.
+*/
+static unsigned int hash_word(const char *word) {
+	unsigned int h = 2166136261u;
+	while(*word != '\0') {
+		h ^= (unsigned char)*word++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/* Initialize an empty dictionary.
+*/
+void init_dict(Dict *dict) {
+	if((dict->table = calloc(DICT_INITIAL_SIZE, sizeof(Node *))) == NULL) {
+		perror("init_dict:");
 		exit(1);
 	}
+	dict->size = DICT_INITIAL_SIZE;
+	dict->count = 0;
+	dict->head = NULL;
+	init_arena(&dict->arena);
+	memset(dict->spare, 0, sizeof(dict->spare));
+	init_stats(&dict->stats);
+	dict->positional = 0;
+}
 
-	strncpy(newnode->word, word, MAXWORD);
-	/*make sure it is null terminated */
-	newnode->word[MAXWORD-1] = '\0';
+/* Release the hash table and, in one go, every node of the dictionary.
+*/
+void free_dict(Dict *dict) {
+	free(dict->table);
+	free_arena(&dict->arena);
+	dict->table = NULL;
+	dict->size = 0;
+	dict->count = 0;
+	dict->head = NULL;
+	memset(dict->spare, 0, sizeof(dict->spare));
+}
 
-        /* memset is a function to fill memory with a constant byte
-           used to initialize memory
-        */
-	memset(newnode->freq, 0, MAXFILES * sizeof(int));
-	newnode->freq[filenum] = count;
-	newnode->next = NULL;
-	return newnode;
+/* Return the memory held by dict: its hash table and its arena.
+*/
+size_t dict_bytes(Dict *dict) {
+	return dict->size * sizeof(Node *) + dict->arena.bytes;
 }
 
-/* Increment the frequency of "word" for the file "fname" in the list
-* pointed to by "head".  If the word is in the list, uses the filenames
-* array to determine which element of the freq array for that word
-* should be incremented. If the word is not in the list, add it in
-* alphabetical order and set the frequency of the word in the file
-* fname to 1.
+/* Return the slot that holds word, or the empty slot where it belongs.
+* Linear probing; the table is never allowed to fill up.  If probes is
+* not NULL the number of slots examined is added to it.
 */
-Node *add_word(Node *head, char **filenames, char *word, char *fname) {
-	Node *cur = head;
-	Node *prev = head;
-	int filenum = get_filenum(fname, filenames);
+static Node **find_slot(Node **table, unsigned int size, const char *word,
+                        unsigned long long *probes) {
+	unsigned int i = hash_word(word) & (size - 1);
+	unsigned int n = 1;
+	while(table[i] != NULL && strcmp(table[i]->word, word) != 0) {
+		i = (i + 1) & (size - 1);
+		n++;
+	}
+	if(probes != NULL) {
+		*probes += n;
+	}
+	return &table[i];
+}
 
-	if(cur && (strcmp(cur->word, word)) > 0) {
-		head = create_node(word, 1, filenum);
-		head->next = cur;
-		num_words++;
-		return head;
+/* Double the size of the hash table and reinsert every node.
+*/
+static void grow_dict(Dict *dict) {
+	unsigned int newsize = dict->size * 2;
+	unsigned int i;
+	Node **newtable;
+	if((newtable = calloc(newsize, sizeof(Node *))) == NULL) {
+		perror("grow_dict:");
+		exit(1);
 	}
+	for(i = 0; i < dict->size; i++) {
+		if(dict->table[i] != NULL) {
+			*find_slot(newtable, newsize, dict->table[i]->word, NULL) = dict->table[i];
+		}
+	}
+	free(dict->table);
+	dict->table = newtable;
+	dict->size = newsize;
+}
+
+/* Return the node for word in the dictionary, adding a node with an
+* empty postings list (at the front of the list) if the word is new.
+* The list is left unsorted; call sort_list() before writing it out.
+*/
+Node *lookup_word(Dict *dict, char *word) {
+	char key[MAXWORD];
+	Node **slot;
+	Node *added;
+
+	/* nodes store at most MAXWORD-1 characters, so hash the same prefix */
+	strncpy(key, word, MAXWORD);
+	key[MAXWORD-1] = '\0';
+
+	slot = find_slot(dict->table, dict->size, key, &dict->stats.counters[STAT_DICT_PROBES]);
+	if(*slot != NULL) {
+		return *slot;
+	}
+
+	added = *slot = create_node(dict, key, 0, 0);
+	added->next = dict->head;
+	dict->head = added;
+	dict->count++;
+
+	/* keep the load factor below 3/4 */
+	if(dict->count * 4 >= dict->size * 3) {
+		grow_dict(dict);
+	}
+	return added;
+}
+
+/* Increment the frequency of "word" for the file filenum (an index
+* returned by add_filename) in the dictionary.  If the word is not in
+* the dictionary, a new node is added with the frequency of the word in
+* the file set to 1.  In a positional dictionary the word's position in
+* the file is recorded too; a file's words must be added in order, and
+* after those of the files before it.  Returns the node for the word.
+*/
+Node *add_word(Dict *dict, char *word, int filenum, int position) {
+	Node *node = lookup_word(dict, word);
+	add_posting(dict, node, filenum, 1);
+	if(dict->positional) {
+		reserve_positions(dict, node, node->num_positions + 1);
+		node->positions[node->num_positions++] = position;
+	}
+	return node;
+}
 
-	/* look for the word */
+/* Renumber the files in every postings list: the postings of file f
+* move to file newnum[f], or are dropped if newnum[f] is -1.  newnum
+* must preserve the order of the files it keeps.  Words left without
+* postings stay in the dictionary and are skipped when it is written.
+*/
+void renumber_postings(Dict *dict, int *newnum) {
+	Node *cur;
+	int i, kept, pos, kept_pos, count;
+
+	for(cur = dict->head; cur != NULL; cur = cur->next) {
+		kept = 0;
+		pos = 0;
+		kept_pos = 0;
+		for(i = 0; i < cur->num_postings; i++) {
+			count = cur->postings[i].count;
+			if(newnum[cur->postings[i].filenum] != -1) {
+				cur->postings[kept].filenum = newnum[cur->postings[i].filenum];
+				cur->postings[kept].count = count;
+				kept++;
+				if(cur->positions != NULL) {
+					memmove(&cur->positions[kept_pos], &cur->positions[pos],
+						count * sizeof(int));
+					kept_pos += count;
+				}
+			}
+			pos += count;
+		}
+		cur->num_postings = kept;
+		if(cur->positions != NULL) {
+			cur->num_positions = kept_pos;
+		}
+	}
+}
+
+/* Copy n positions from *from to *to, advancing both.
+*/
+static void copy_positions(int **to, int **from, int n) {
+	memcpy(*to, *from, n * sizeof(int));
+	*to += n;
+	*from += n;
+}
+
+/* Merge the postings of from into into, both nodes of dict.  Both
+* lists are sorted by filenum, so this is a single linear merge, which
+* carries the positions of each posting along.
+*/
+static void merge_postings(Dict *dict, Node *into, Node *from) {
+	int total = into->num_postings + from->num_postings;
+	int ptotal = into->num_positions + from->num_positions;
+	int i = 0, j = 0, k = 0;
+	int a, b;
+	Posting *merged;
+	int *positions = NULL;
+	int *pi = into->positions, *pj = from->positions, *pk = NULL;
+
+	merged = alloc_postings(dict, &total);
+	if(dict->positional) {
+		pk = positions = alloc_positions(dict, &ptotal);
+	}
+	while(i < into->num_postings || j < from->num_postings) {
+		if(j == from->num_postings ||
+		   (i < into->num_postings &&
+		    into->postings[i].filenum < from->postings[j].filenum)) {
+			if(pk != NULL) {
+				copy_positions(&pk, &pi, into->postings[i].count);
+			}
+			merged[k++] = into->postings[i++];
+		} else if(i == into->num_postings ||
+		          from->postings[j].filenum < into->postings[i].filenum) {
+			if(pk != NULL) {
+				copy_positions(&pk, &pj, from->postings[j].count);
+			}
+			merged[k++] = from->postings[j++];
+		} else {
+			if(pk != NULL) {
+				a = into->postings[i].count;
+				b = from->postings[j].count;
+				while(a > 0 || b > 0) {
+					if(b == 0 || (a > 0 && *pi < *pj)) {
+						*pk++ = *pi++;
+						a--;
+					} else {
+						*pk++ = *pj++;
+						b--;
+					}
+				}
+			}
+			merged[k] = into->postings[i++];
+			merged[k++].count += from->postings[j++].count;
+		}
+	}
+	release_postings(dict, into->postings, into->max_postings);
+	release_postings(dict, from->postings, from->max_postings);
+	into->postings = merged;
+	into->num_postings = k;
+	into->max_postings = total;
+	if(positions != NULL) {
+		release_positions(dict, into->positions, into->max_positions);
+		release_positions(dict, from->positions, from->max_positions);
+		into->positions = positions;
+		into->num_positions = pk - positions;
+		into->max_positions = ptotal;
+	}
+}
+
+/* Move every word of the dictionary from into the dictionary into.
+* The arena of from is handed over to into, so nodes for words that are
+* new to into are relinked rather than copied; the others have their
+* postings merged.  from is left empty (but still has to be released
+* with free_dict).
+*/
+void merge_dict(Dict *into, Dict *from) {
+	Node *cur = from->head;
+	Node *next;
+	Node **slot;
+
+	arena_adopt(&into->arena, &from->arena);
+	memset(from->spare, 0, sizeof(from->spare));
+	add_stats(&into->stats, &from->stats);
+	init_stats(&from->stats);
 	while(cur != NULL) {
-		if((strcmp(cur->word, word)) == 0) {
-		/* found word */
-
-			cur->freq[filenum] += 1;
-			return head;
-		} else if ((strcmp(cur->word, word)) > 0) {
-		/* need to insert word */
-			if( cur == prev ) { /* we are at the head */
-				prev = create_node(word, 1, filenum);
-				prev->next = cur;
-				num_words++;
-				return prev;
-			} else {
-				prev->next = create_node(word, 1, filenum);
-				prev->next->next = cur;
-				num_words++;
-				return head;
+		next = cur->next;
+		slot = find_slot(into->table, into->size, cur->word, NULL);
+		if(*slot == NULL) {
+			*slot = cur;
+			cur->next = into->head;
+			into->head = cur;
+			into->count++;
+			if(into->count * 4 >= into->size * 3) {
+				grow_dict(into);
 			}
-		} 
+		} else {
+			merge_postings(into, *slot, cur);
+		}
+		cur = next;
+	}
+	from->head = NULL;
+	from->count = 0;
+	memset(from->table, 0, from->size * sizeof(Node *));
+}
 
-		prev = cur;
-		cur = cur->next;
+/* Sort the list headed by head alphabetically using a merge sort and
+* return the new head of the list.
+*/
+Node *sort_list(Node *head) {
+	Node *slow, *fast, *right;
+	Node merged;
+	Node *tail = &merged;
+
+	if(head == NULL || head->next == NULL) {
+		return head;
 	}
-	if(cur == prev) {
-		num_words++;
-		return create_node(word, 1, filenum);
-	} else {
-		if (cur == NULL){ 
-			num_words++;
-			prev->next = create_node(word, 1, filenum);
+
+	/* split the list in half */
+	slow = head;
+	fast = head->next;
+	while(fast != NULL && fast->next != NULL) {
+		slow = slow->next;
+		fast = fast->next->next;
+	}
+	right = slow->next;
+	slow->next = NULL;
+
+	head = sort_list(head);
+	right = sort_list(right);
+
+	while(head != NULL && right != NULL) {
+		if(strcmp(head->word, right->word) <= 0) {
+			tail->next = head;
+			head = head->next;
+		} else {
+			tail->next = right;
+			right = right->next;
 		}
-		return head;	
+		tail = tail->next;
 	}
+	tail->next = (head != NULL) ? head : right;
+	return merged.next;
 }
 
 /* Print the list to standard output in a readable format. 
 * (Primarily useful for debugging purposes.)
 */
 
-void display_list(Node *head, char **filenames) {
+void display_list(Node *head, FileTable *files) {
 	Node *cur = head;
 	int i;
 	while(cur != NULL) {
 		printf("%s\n", cur->word);
-		for(i = 0; i < MAXFILES; i++) {
-			if(filenames[i] != NULL) {
-				printf("    %d %s ", cur->freq[i], filenames[i]);
-			} else {
-				printf("\n");
-				break;
-			}
+		for(i = 0; i < cur->num_postings; i++) {
+			printf("    %d %s ", cur->postings[i].count,
+				files->names[cur->postings[i].filenum]);
 		}
+		printf("\n");
 		cur = cur->next;
 	}
 }
 
-/* Print the linked list of words to two files.  The array of file names
-* will be written one line per file in text format to namefile.  The
-* linked list will be written to the file listfile in binary format.
+/* Write the file names to namefile and move the index written to
+* tmplist into place as listfile.
 */
-void write_list(char *namefile, char *listfile, Node *head, char **filenames) {
-	Node *cur = head;
+static void finish_list(char *namefile, char *listfile, char *tmplist,
+                        FileTable *files) {
+	char tmpname[PATHLENGTH + 8];
 	int i;
 
-	/* Write out the linked list */
-	FILE *list_fp;
-	if((list_fp = fopen(listfile, "w")) == NULL) {
-		perror("List file");
-		exit(1);
-	}
-	while (cur != NULL) {
-                 /* fwrite is a function similar to the write function we have seen in lecture
-                    except that it works on FILE * instead of file descriptors;
-                    it is used to write binary output to a file (rather than characters).
-                 */
-		fwrite(cur, sizeof(Node), 1, list_fp);
-		cur = cur->next;
-	}
-	if(fclose(list_fp)) {
-		perror("fclose");
-	}
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp", namefile);
 
 	/* Write the file names array */
 	FILE *fname_fp;
-	if((fname_fp = fopen(namefile, "w")) == NULL) {
+	if((fname_fp = fopen(tmpname, "w")) == NULL) {
 		perror("Name file");
 		exit(1);
 	}
-	for(i = 0; i < MAXFILES; i++) {
-		if(filenames[i] == NULL) {
-			break;
-		}
-		fprintf(fname_fp, "%s\n", filenames[i]);
+	for(i = 0; i < files->count; i++) {
+		fprintf(fname_fp, "%s\n", files->names[i]);
 	}
 	if(fclose(fname_fp)) {
 		perror("fclose");
+		exit(1);
+	}
+
+	if(rename(tmplist, listfile) == -1 || rename(tmpname, namefile) == -1) {
+		perror("rename");
+		exit(1);
 	}
 }
 
-/* Populate the linked list and filenames data structures with data
-* stored in two files.  The data in namefile is used to construct the
-* filenames array, and the data in listfile is used to construct a
-* linked list.  Note that filenames must point to an array of the
-* correct size, but that head does not point to a list node when it is
-* passed in.
+/* Print the linked list of words to two files.  The file names will be
+* written one line per file in text format to namefile.  The sorted
+* linked list will be written to the file listfile in the binary index
+* format described in diskindex.h.  Both are written to temporary files
+* that are then renamed, so a worker that has the old index mapped never
+* sees a half-written file.  flags (see diskindex.h) are recorded in the
+* index; with INDEX_POSITIONS the words' positions are written too.
 */
-void read_list(char *listfile, char *namefile, 
-			Node **head, char **filenames) {
+void write_list(char *namefile, char *listfile, Node *head, FileTable *files,
+                int flags) {
+	char tmplist[PATHLENGTH + 8];
 
-	/* Read in the linked list */
-	FILE *list_fp;
-	if((list_fp = fopen(listfile, "r")) == NULL) {
-		perror("List file");
-		exit(1);
-	}
+	snprintf(tmplist, sizeof(tmplist), "%s.tmp", listfile);
+	write_index(tmplist, head, files, flags);
+	finish_list(namefile, listfile, tmplist, files);
+}
 
-	Node *cur = malloc(sizeof(Node));
-	Node *prev = NULL;
-	*head = cur;
+/* Like write_list, but the index is merged from the sorted runs that
+* were written out while indexing (see merge_indexes).
+*/
+void merge_list(char *namefile, char *listfile, char **runs, int num_runs,
+                FileTable *files) {
+	char tmplist[PATHLENGTH + 8];
 
-        /* fread is a function similar to the read function we have seen in lecture
-           except that it works on FILE * instead of file descriptors;
-           it is used to read binary input (rather than characters).
-        */
-	while((fread(cur, sizeof(Node), 1, list_fp)) != 0) {
-		cur->next = NULL;
-		if(cur == *head) {
-			prev = cur;
-		} else {
-			prev->next = cur;
-			prev = cur;
-		}
-		cur = malloc(sizeof(Node));
-	}
-	if((fclose(list_fp))) {
-		perror("fclose");
-	}
+	snprintf(tmplist, sizeof(tmplist), "%s.tmp", listfile);
+	merge_indexes(tmplist, runs, num_runs, files);
+	finish_list(namefile, listfile, tmplist, files);
+}
 
-	/* Read in the file names */
+/* Populate the file table with the names stored one per line in
+* namefile.  files must have been initialized with init_filenames.
+* Returns -1 if namefile can not be read.
+*/
+int load_filenames(char *namefile, FileTable *files) {
 	FILE *fname_fp;
 	if((fname_fp = fopen(namefile, "r")) == NULL) {
-		perror("Name file");
-		exit(1);
+		perror(namefile);
+		return -1;
 	}
 	char line[MAXLINE];
-	int i = 0;
 	while((fgets(line, MAXLINE, fname_fp)) != NULL) {
-		line[strlen(line)-1] = '\0';
-		char *name = malloc(strlen(line) + 1);
-		strncpy(name, line, (strlen(line) + 1));
-		filenames[i] = name;
-		i++;
+		line[strcspn(line, "\n")] = '\0';
+		add_filename(files, line);
 	}
 	if((fclose(fname_fp))) {
 		perror("fclose");
 	}
+	return 0;
 }
 
-/* Create an array to hold filenames and initialize it to all NULL 
-*/
+void read_filenames(char *namefile, FileTable *files) {
+	if(load_filenames(namefile, files) == -1) {
+		exit(1);
+	}
+}
 
-char **init_filenames() {
+/* A hash of the file names in order.  The indexer records it in the
+* index, so that a reader can tell whether the file names next to an
+* index are the ones that were written with it.
+*/
+unsigned long long filenames_hash(FileTable *files) {
+	unsigned long long h = FNV64_OFFSET;
 	int i;
-	char **fnames = malloc(MAXFILES * sizeof(char *));
-	for(i = 0; i < MAXFILES; i++) {
-		fnames[i] = NULL;
+	for(i = 0; i < files->count; i++) {
+		h = hash_bytes(h, files->names[i], strlen(files->names[i]) + 1);
 	}
-	return fnames;
+	return h;
 }
 
-/* If fname is in the filenames array, then return its index.
-* Otherwise add the filename to the array and return the new index.
-* Currently implemented as a linear search.
+/* Initialize an empty file table.
 */
 
-int get_filenum(char *fname, char **filenames) {
-	int i;
-	for(i = 0; i < MAXFILES; i++) {
-		if(filenames[i] == NULL) {
-			filenames[i] = malloc(strlen(fname)+1);
-			strncpy(filenames[i], fname, strlen(fname)+1);
-			return i;
-		}
-		if((strcmp(fname, filenames[i])) == 0) {
-			return i;
-		}
-	}
-	for(i = 0; i < MAXFILES; i++) {
-		if(filenames[i] != NULL) {
-			fprintf(stderr, "filenames[%d] = %s\n", i, filenames[i]);
-		} else {
-			break;
+void init_filenames(FileTable *files) {
+	files->names = NULL;
+	files->info = NULL;
+	files->count = 0;
+	files->capacity = 0;
+	init_arena(&files->arena);
+}
+
+/* Release the file table and all of the names in it.
+*/
+
+void free_filenames(FileTable *files) {
+	free(files->names);
+	free(files->info);
+	free_arena(&files->arena);
+	files->names = NULL;
+	files->info = NULL;
+	files->count = 0;
+	files->capacity = 0;
+}
+
+/* Append fname to the file table, with its FileInfo zeroed, and return
+* its index.  The table
+* grows as needed, so there is no limit on the number of files.
+*/
+
+int add_filename(FileTable *files, char *fname) {
+	if(files->count == files->capacity) {
+		int newcap = (files->capacity == 0) ? 64 : files->capacity * 2;
+		char **names = realloc(files->names, newcap * sizeof(char *));
+		FileInfo *info = realloc(files->info, newcap * sizeof(FileInfo));
+		if(names == NULL || info == NULL) {
+			perror("add_filename:");
+			exit(1);
 		}
+		files->names = names;
+		files->info = info;
+		files->capacity = newcap;
 	}
-	fprintf(stderr, "Too many files\n");
-	exit(1);
+	memset(&files->info[files->count], 0, sizeof(FileInfo));
+	files->names[files->count] = arena_strdup(&files->arena, fname, strlen(fname));
+	return files->count++;
 }
@@ -1,23 +1,105 @@
-#define MAXFILES 50
+#include "arena.h"
+#include "stats.h"
+
 #define MAXWORD 32
 #define MAXLINE 1024
 #define PATHLENGTH 128
 
+/* One entry of a word's postings list: the number of times the word
+* occurs in the file with index filenum in the file table.
+*/
+typedef struct {
+    int filenum;
+    int count;
+} Posting;
+
+/* postings is a growable array kept sorted by filenum, so a word only
+* costs memory for the files it actually occurs in.  In a positional
+* dictionary, positions holds the token offsets of every occurrence, in
+* the order of the postings: count offsets, ascending, per posting.  The
+* node, its word (at most MAXWORD-1 characters), its postings and its
+* positions are all allocated from the arena of the Dict that holds it.
+*/
 struct node {
-    char word[MAXWORD];
-    int freq[MAXFILES];
+    char *word;
+    int num_postings;
+    int max_postings;
+    Posting *postings;
+    int num_positions;
+    int max_positions;
+    int *positions;
     struct node *next;
 };
 
 typedef struct node Node; 
 
-extern int num_words;
+#define CHUNK_CLASSES 40
+
+/* Open-addressing hash table used to find the node for a word in
+* constant time while indexing.  The nodes are also kept on a linked
+* list (most recently added first) which is sorted by sort_list()
+* before the index is written.  spare[k] is a list of outgrown postings
+* or positions arrays of 2^k bytes, waiting to be reused.  stats counts
+* the work done on the dictionary (and by index_file for it).  If
+* positional is set, add_word records the position of every word.
+*/
+typedef struct {
+    Node **table;
+    unsigned int size;
+    unsigned int count;
+    Node *head;
+    Arena arena;
+    void *spare[CHUNK_CLASSES];
+    Stats stats;
+    int positional;
+} Dict;
+
+/* What the index records about each file: the number of words indexed
+* from it (for ranking), and its modification time, size and a hash of
+* its contents, so that an incremental run can tell if it has changed.
+*/
+typedef struct {
+    long long mtime;
+    long long size;
+    unsigned long long hash;
+    int length;
+    int reserved;
+} FileInfo;
+
+/* Growable array of the names of the indexed files.  A file's position
+* in the array is the filenum used in the postings lists.  info is a
+* parallel array of what is known about each file.  The names themselves
+* are allocated from arena.
+*/
+typedef struct {
+    char **names;
+    FileInfo *info;
+    int count;
+    int capacity;
+    Arena arena;
+} FileTable;
 
-Node *create_node(char *word, int count, int filenum);
-Node *add_word(Node *head, char **filenames, char *word, char *fname);
+void init_dict(Dict *dict);
+void free_dict(Dict *dict);
+Node *create_node(Dict *dict, char *word, int count, int filenum);
+void reserve_postings(Dict *dict, Node *node, int n);
+void reserve_positions(Dict *dict, Node *node, int n);
+void add_posting(Dict *dict, Node *node, int filenum, int count);
+Node *lookup_word(Dict *dict, char *word);
+Node *add_word(Dict *dict, char *word, int filenum, int position);
+void renumber_postings(Dict *dict, int *newnum);
+void merge_dict(Dict *into, Dict *from);
+size_t dict_bytes(Dict *dict);
+Node *sort_list(Node *head);
 void print_list(FILE *fp, struct node *head);
-char **init_filenames();
-int get_filenum(char *fname, char **filenames);
-void display_list(Node *head, char **filenames);
-void write_list(char *namefile, char *listfile, Node *head, char **filenames);
-void read_list(char *listfile, char *namefile, Node **head, char **filenames);
+void init_filenames(FileTable *files);
+void free_filenames(FileTable *files);
+int add_filename(FileTable *files, char *fname);
+void display_list(Node *head, FileTable *files);
+void write_list(char *namefile, char *listfile, Node *head, FileTable *files,
+                int flags);
+void merge_list(char *namefile, char *listfile, char **runs, int num_runs,
+                FileTable *files);
+int load_filenames(char *namefile, FileTable *files);
+void read_filenames(char *namefile, FileTable *files);
+unsigned long long filenames_hash(FileTable *files);
@@ -0,0 +1,156 @@
+/* Generate a synthetic corpus for benchmarking: a start directory with
+* one subdirectory (shard) per index, each holding text files whose
+* words are drawn from a Zipf distribution over a made-up vocabulary,
+* plus a file of query words.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define WORDS_PER_LINE 12
+
+static unsigned long long rng_state = 88172645463325252ull;
+
+/* xorshift64* */
+static unsigned long long next_random(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ull;
+}
+
+static double uniform(void) {
+    return (next_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Build word number rank of the vocabulary: 4 to 12 letters chosen from
+* a hash of the rank, so every run produces the same vocabulary.
+*/
+static void make_word(int rank, char *word) {
+    unsigned long long h = rank * 0x9E3779B97F4A7C15ull + 12345;
+    int len, i;
+    h ^= h >> 31;
+    len = 4 + h % 9;
+    for (i = 0; i < len; i++) {
+        h = h * 6364136223846793005ull + 1442695040888963407ull;
+        word[i] = 'a' + (h >> 33) % 26;
+    }
+    word[len] = '\0';
+}
+
+/* Return a rank drawn from the Zipf distribution whose cumulative
+* weights are in cdf.
+*/
+static int zipf_rank(double *cdf, int vocab) {
+    double u = uniform() * cdf[vocab - 1];
+    int lo = 0, hi = vocab - 1, mid;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (cdf[mid] < u) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int main(int argc, char **argv) {
+    char ch;
+    char *outdir = "bench_corpus";
+    int shards = 8, files = 40, words = 5000, vocab = 50000, queries = 2000;
+    double skew = 1.0;
+    char path[512], word[16];
+    double *cdf;
+    long long total_bytes = 0, total_words = 0;
+    int s, f, w, i;
+    FILE *fp;
+
+    while ((ch = getopt(argc, argv, "o:s:f:w:v:z:q:r:")) != -1) {
+        switch (ch) {
+            case 'o': outdir = optarg; break;
+            case 's': shards = strtol(optarg, NULL, 10); break;
+            case 'f': files = strtol(optarg, NULL, 10); break;
+            case 'w': words = strtol(optarg, NULL, 10); break;
+            case 'v': vocab = strtol(optarg, NULL, 10); break;
+            case 'z': skew = strtod(optarg, NULL); break;
+            case 'q': queries = strtol(optarg, NULL, 10); break;
+            case 'r': rng_state = strtoull(optarg, NULL, 10) | 1; break;
+            default:
+                fprintf(stderr, "Usage: gencorpus [-o DIR] [-s SHARDS] [-f FILES_PER_SHARD]"
+                        " [-w WORDS_PER_FILE] [-v VOCABULARY] [-z SKEW] [-q QUERIES]"
+                        " [-r SEED]\n");
+                exit(1);
+        }
+    }
+    if (shards < 1 || files < 1 || words < 0 || vocab < 1 || queries < 0) {
+        fprintf(stderr, "gencorpus: sizes must be positive\n");
+        exit(1);
+    }
+
+    if ((cdf = malloc(vocab * sizeof(double))) == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    for (i = 0; i < vocab; i++) {
+        cdf[i] = (i > 0 ? cdf[i - 1] : 0.0) + 1.0 / pow(i + 1, skew);
+    }
+
+    if (mkdir(outdir, 0755) == -1 && access(outdir, W_OK) == -1) {
+        perror(outdir);
+        exit(1);
+    }
+    for (s = 0; s < shards; s++) {
+        snprintf(path, sizeof(path), "%s/shard%03d", outdir, s);
+        if (mkdir(path, 0755) == -1 && access(path, W_OK) == -1) {
+            perror(path);
+            exit(1);
+        }
+        for (f = 0; f < files; f++) {
+            snprintf(path, sizeof(path), "%s/shard%03d/file%05d.txt", outdir, s, f);
+            if ((fp = fopen(path, "w")) == NULL) {
+                perror(path);
+                exit(1);
+            }
+            for (w = 0; w < words; w++) {
+                make_word(zipf_rank(cdf, vocab), word);
+                // some capitals and punctuation for the tokenizer to strip
+                if (next_random() % 16 == 0) {
+                    word[0] += 'A' - 'a';
+                }
+                fputs(word, fp);
+                if (next_random() % 20 == 0) {
+                    fputc(',', fp);
+                }
+                fputc((w + 1) % WORDS_PER_LINE == 0 ? '\n' : ' ', fp);
+            }
+            fputc('\n', fp);
+            total_bytes += ftell(fp);
+            total_words += words;
+            fclose(fp);
+        }
+    }
+
+    // Half the queries follow the corpus distribution, half are uniform
+    // over the vocabulary, so both common and rare words are looked up.
+    snprintf(path, sizeof(path), "%s/queries", outdir);
+    if ((fp = fopen(path, "w")) == NULL) {
+        perror(path);
+        exit(1);
+    }
+    for (i = 0; i < queries; i++) {
+        make_word(i % 2 == 0 ? zipf_rank(cdf, vocab) : (int)(next_random() % vocab), word);
+        fprintf(fp, "%s\n", word);
+    }
+    fclose(fp);
+
+    printf("generated %d shards x %d files: %lld words, %.1f MB in %s\n",
+           shards, files, total_words, total_bytes / 1e6, outdir);
+    free(cdf);
+    return 0;
+}
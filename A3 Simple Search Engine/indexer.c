@@ -3,63 +3,718 @@
 #include <unistd.h>
 #include <dirent.h>
 #include <stdlib.h>
-#include <ctype.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include "freq_list.h"
+#include "diskindex.h"
+#include "tokenize.h"
+#include "normalize.h"
 
 
-char *remove_punc(char *);
-
-/* index_file returns a pointer to linked list of nodes where each node
-* contains a word and count of the number of occurrences of the node.
+/* Hash the contents of the file fname, as recorded in FileInfo.
 */
-
-Node *index_file(Node *head, char *fname, char **filenames) {
-	char line[MAXLINE];
-	char *marker, *token;
-	int countlines = 0;
+static unsigned long long hash_file(char *fname) {
+	char buf[8192];
+	size_t n;
+	unsigned long long h = FNV64_OFFSET;
 	FILE *fp;
 	if((fp = fopen(fname, "r")) == NULL) {
 		perror(fname);
 		exit(1);
 	}
-	while((fgets(line, MAXLINE, fp)) != NULL) {
-		countlines++;
-		if((countlines % 1000) == 0) {
-			printf("processed %d lines from %s (words%d)\n", countlines, fname, num_words);
-		}
-		line[strlen(line)-1] = '\0';
-		if(strlen(line) == 0) {
+	while((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+		h = hash_bytes(h, buf, n);
+	}
+	fclose(fp);
+	return h;
+}
+
+/* index_file adds every word in fname to the dictionary, recording
+* the occurrences under the file number filenum.  Each node contains a
+* word and count of the number of occurrences of the node.  Each token
+* goes through normalize_word and is indexed in the form it returns;
+* the tokens it rejects are skipped, but still count as positions: a
+* word's position is the number of tokens before it in the file.
+* The number of words indexed and the file's mtime, size and content
+* hash are stored in info, and what was read is counted in dict->stats.
+*/
+
+void index_file(Dict *dict, char *fname, int filenum, FileInfo *info) {
+	Tokenizer t;
+	char *token;
+	int len;
+	int countwords = 0;
+	int skipped = 0;
+	struct stat sbuf;
+	if(open_tokenizer(&t, fname) == -1) {
+		perror(fname);
+		exit(1);
+	}
+	if(fstat(t.fd, &sbuf) == -1) {
+		perror(fname);
+		exit(1);
+	}
+	while((token = next_token(&t, &len)) != NULL) {
+		if(normalize_word(token, len) == 0) {
+			skipped++;
 			continue;
 		}
-		marker = line;
-		while((token = strsep(&marker, " \t")) != NULL) {
-			if(strlen(token) == 0) {
-				continue;
+		add_word(dict, token, filenum, countwords + skipped);
+		countwords++;
+		if((countwords % 1000000) == 0) {
+			printf("processed %d words from %s (words%d)\n", countwords, fname, dict->count);
+		}
+	}
+	info->length = countwords;
+	info->mtime = sbuf.st_mtime;
+	info->size = sbuf.st_size;
+	info->hash = t.hash;
+	dict->stats.counters[STAT_BYTES_READ] += t.bytes;
+	dict->stats.counters[STAT_TOKENS] += countwords + skipped;
+	dict->stats.counters[STAT_TOKENS_DROPPED] += t.dropped;
+	dict->stats.counters[STAT_TOKENS_SKIPPED] += skipped;
+	dict->stats.counters[STAT_FILES]++;
+	close_tokenizer(&t);
+}
+
+/* The sorted runs written out by -m when a dictionary outgrows its
+* share of the memory budget.  Each run is an index file of its own,
+* named after the index with a ".runN" suffix; the runs are merged into
+* the index at the end and then removed.
+*/
+typedef struct {
+	char *indexfile;
+	int flags;			/* of the index, see diskindex.h */
+	size_t budget;		/* bytes of dictionaries, 0 for no limit */
+	char **names;
+	int count;
+	int capacity;
+	pthread_mutex_t lock;
+} RunList;
+
+/* Write the words in dict out as the next run and empty dict, keeping
+* its stats and settings.  Runs record no file information; that is added when they
+* are merged.
+*/
+static void spill_dict(RunList *runs, Dict *dict) {
+	char name[PATHLENGTH + 16];
+	char *path;
+	FileTable none;
+	Stats stats;
+	unsigned long long start = stats_clock();
+
+	pthread_mutex_lock(&runs->lock);
+	if(runs->count == runs->capacity) {
+		runs->capacity = (runs->capacity == 0) ? 16 : runs->capacity * 2;
+		if((runs->names = realloc(runs->names, runs->capacity * sizeof(char *))) == NULL) {
+			perror("malloc");
+			exit(1);
+		}
+	}
+	snprintf(name, sizeof(name), "%s.run%d", runs->indexfile, runs->count);
+	if((path = strdup(name)) == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	runs->names[runs->count++] = path;
+	pthread_mutex_unlock(&runs->lock);
+
+	printf("Writing run: %s (%u words)\n", path, dict->count);
+	init_filenames(&none);
+	write_index(path, sort_list(dict->head), &none, runs->flags);
+	free_filenames(&none);
+	stats = dict->stats;
+	free_dict(dict);
+	init_dict(dict);
+	dict->stats = stats;
+	dict->positional = (runs->flags & INDEX_POSITIONS) != 0;
+	stop_timer(&dict->stats, TIMER_WRITE, start);
+	dict->stats.counters[STAT_RUNS]++;
+}
+
+/* Spill dict if it uses more than budget bytes (0 means no limit).
+*/
+static void check_budget(RunList *runs, Dict *dict, size_t budget) {
+	if(budget > 0 && dict_bytes(dict) > budget) {
+		spill_dict(runs, dict);
+	}
+}
+
+/* Work shared by the indexing threads: the files still to be indexed
+* are taken from the file table in order, by file number, starting at
+* next_file.
+*/
+typedef struct {
+	FileTable *files;
+	int next_file;
+	pthread_mutex_t lock;
+	RunList *runs;
+	size_t budget;		/* each thread's share of runs->budget */
+} WorkQueue;
+
+typedef struct {
+	WorkQueue *queue;
+	Dict dict;
+} IndexThread;
+
+/* Thread body for -j: repeatedly take the next file from the queue and
+* add its words to the thread's own partial dictionary.  Each thread
+* takes files in increasing order, so its postings stay sorted.  With
+* -m, a thread spills its dictionary when it outgrows its share of the
+* memory budget.
+*/
+static void *index_worker(void *arg) {
+	IndexThread *self = arg;
+	WorkQueue *queue = self->queue;
+	int filenum;
+
+	while(1) {
+		pthread_mutex_lock(&queue->lock);
+		filenum = queue->next_file++;
+		pthread_mutex_unlock(&queue->lock);
+		if(filenum >= queue->files->count) {
+			break;
+		}
+		printf("Indexing: %s\n", queue->files->names[filenum]);
+		index_file(&self->dict, queue->files->names[filenum], filenum,
+			&queue->files->info[filenum]);
+		check_budget(queue->runs, &self->dict, queue->budget);
+	}
+	return NULL;
+}
+
+typedef struct {
+	Dict *into;
+	Dict *from;
+} MergeJob;
+
+static void *merge_worker(void *arg) {
+	MergeJob *job = arg;
+	merge_dict(job->into, job->from);
+	return NULL;
+}
+
+/* Index the files in the table from first on using nthreads threads,
+* each with its own partial dictionary, then merge the partial
+* dictionaries pairwise (in parallel, as a tree) into dict.
+*/
+static void index_parallel(Dict *dict, FileTable *files, int first, int nthreads,
+                           RunList *runs) {
+	WorkQueue queue;
+	IndexThread *threads;
+	pthread_t *tids;
+	MergeJob *jobs;
+	int i, step, njobs;
+	unsigned long long start;
+
+	queue.files = files;
+	queue.next_file = first;
+	pthread_mutex_init(&queue.lock, NULL);
+	queue.runs = runs;
+	queue.budget = runs->budget / nthreads;
+
+	threads = malloc(nthreads * sizeof(IndexThread));
+	tids = malloc(nthreads * sizeof(pthread_t));
+	jobs = malloc(nthreads * sizeof(MergeJob));
+	if(threads == NULL || tids == NULL || jobs == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+
+	for(i = 0; i < nthreads; i++) {
+		threads[i].queue = &queue;
+		init_dict(&threads[i].dict);
+		threads[i].dict.positional = dict->positional;
+		if(pthread_create(&tids[i], NULL, index_worker, &threads[i]) != 0) {
+			fprintf(stderr, "pthread_create failed\n");
+			exit(1);
+		}
+	}
+	for(i = 0; i < nthreads; i++) {
+		pthread_join(tids[i], NULL);
+	}
+
+	start = stats_clock();
+	for(step = 1; step < nthreads; step *= 2) {
+		njobs = 0;
+		for(i = 0; i + step < nthreads; i += 2 * step) {
+			jobs[njobs].into = &threads[i].dict;
+			jobs[njobs].from = &threads[i + step].dict;
+			if(pthread_create(&tids[njobs], NULL, merge_worker, &jobs[njobs]) != 0) {
+				fprintf(stderr, "pthread_create failed\n");
+				exit(1);
 			}
-			token = remove_punc(token);
-			if((strlen(token) <= 3) || isdigit(*token)) {
-			    	continue;
+			njobs++;
+		}
+		for(i = 0; i < njobs; i++) {
+			pthread_join(tids[i], NULL);
+		}
+	}
+
+	merge_dict(dict, &threads[0].dict);
+	stop_timer(&dict->stats, TIMER_MERGE, start);
+	for(i = 0; i < nthreads; i++) {
+		free_dict(&threads[i].dict);
+	}
+	pthread_mutex_destroy(&queue.lock);
+	free(threads);
+	free(tids);
+	free(jobs);
+}
+
+/* A file name and its number, for looking up names by binary search. */
+typedef struct {
+	char *name;
+	int filenum;
+} NamedFile;
+
+static int compare_named(const void *a, const void *b) {
+	return strcmp(((const NamedFile *)a)->name, ((const NamedFile *)b)->name);
+}
+
+/* Return 1 if the file at path still matches what the index recorded
+* about it.  A file whose mtime changed but whose size and contents did
+* not (for example one that was only touched) counts as unchanged.
+*/
+static int file_unchanged(char *path, const FileInfo *info) {
+	struct stat sbuf;
+	if(stat(path, &sbuf) == -1) {
+		perror(path);
+		exit(1);
+	}
+	if(sbuf.st_size != info->size) {
+		return 0;
+	}
+	return sbuf.st_mtime == info->mtime || hash_file(path) == info->hash;
+}
+
+/* Compare the files found in the directory (scan) with the ones
+* recorded in the existing index, for indexer -u.  The words of the
+* index are loaded into dict and the files that are unchanged are
+* copied to files, renumbered in order; postings of files that changed
+* or were deleted are dropped.  The changed and new files are then
+* appended to files.  Returns the number of the first file that still
+* has to be indexed, or -1 if the index can not be updated because it
+* does (or does not) have positions and dict does not (or does), or
+* because it was built with a different normalization pipeline.
+*/
+static int prepare_update(char *indexfile, char *namefile, FileTable *scan,
+                          Dict *dict, FileTable *files) {
+	DiskIndex old;
+	FileTable oldfiles;
+	NamedFile *byname, *found, key;
+	struct stat sbuf;
+	int *newnum, *oldnum;
+	int i, o, first;
+	int changed = 0, deleted = 0;
+
+	open_index(indexfile, &old);
+	if(((old.header->flags & INDEX_POSITIONS) != 0) != dict->positional) {
+		printf("Rebuilding: %s %s positions\n", indexfile,
+			dict->positional ? "has no" : "has");
+		close_index(&old);
+		return -1;
+	}
+	if(old.header->normalize != NORMALIZE_CONFIG) {
+		printf("Rebuilding: %s was built with a different normalization\n",
+			indexfile);
+		close_index(&old);
+		return -1;
+	}
+	init_filenames(&oldfiles);
+	read_filenames(namefile, &oldfiles);
+	if((uint32_t)oldfiles.count != old.header->num_files ||
+	   filenames_hash(&oldfiles) != old.header->names_hash) {
+		fprintf(stderr, "%s and %s do not match\n", indexfile, namefile);
+		exit(1);
+	}
+	load_dict(&old, dict);
+
+	/* oldnum[i] is the old number of scan->names[i], or -1 */
+	newnum = malloc((oldfiles.count + 1) * sizeof(int));
+	oldnum = malloc((scan->count + 1) * sizeof(int));
+	if(newnum == NULL || oldnum == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	for(o = 0; o < oldfiles.count; o++) {
+		newnum[o] = -1;
+	}
+	byname = malloc((oldfiles.count + 1) * sizeof(NamedFile));
+	if(byname == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	for(o = 0; o < oldfiles.count; o++) {
+		byname[o].name = oldfiles.names[o];
+		byname[o].filenum = o;
+	}
+	qsort(byname, oldfiles.count, sizeof(NamedFile), compare_named);
+
+	for(i = 0; i < scan->count; i++) {
+		oldnum[i] = -1;
+		key.name = scan->names[i];
+		found = bsearch(&key, byname, oldfiles.count, sizeof(NamedFile), compare_named);
+		if(found == NULL) {
+			continue;
+		}
+		o = found->filenum;
+		if(file_unchanged(scan->names[i], &old.files[o])) {
+			oldnum[i] = o;
+			newnum[o] = 0;
+		} else {
+			changed++;
+		}
+	}
+
+	/* keep the unchanged files, in their old order */
+	for(o = 0; o < oldfiles.count; o++) {
+		if(newnum[o] == -1) {
+			continue;
+		}
+		newnum[o] = add_filename(files, oldfiles.names[o]);
+		files->info[newnum[o]] = old.files[o];
+	}
+	first = files->count;
+	deleted = oldfiles.count - first - changed;
+	for(i = 0; i < scan->count; i++) {
+		if(oldnum[i] == -1) {
+			add_filename(files, scan->names[i]);
+		} else if(stat(scan->names[i], &sbuf) == 0) {
+			files->info[newnum[oldnum[i]]].mtime = sbuf.st_mtime;
+		}
+	}
+	renumber_postings(dict, newnum);
+	printf("Updating: %d unchanged, %d changed, %d added, %d deleted\n",
+		first, changed, files->count - first - changed, deleted);
+
+	close_index(&old);
+	free_filenames(&oldfiles);
+	free(newnum);
+	free(oldnum);
+	free(byname);
+	return first;
+}
+
+/* Return 1 if the entry name in dirname should be indexed: it must be a
+* regular file and not one of the files the index is written to.
+*/
+static int want_file(char *path, struct stat *indexstat, struct stat *namestat) {
+	struct stat sbuf;
+	if(stat(path, &sbuf) == -1 || !S_ISREG(sbuf.st_mode)) {
+		return 0;
+	}
+	if((sbuf.st_dev == indexstat->st_dev && sbuf.st_ino == indexstat->st_ino) ||
+	   (sbuf.st_dev == namestat->st_dev && sbuf.st_ino == namestat->st_ino)) {
+		return 0;
+	}
+	return 1;
+}
+
+/* Index the files in dirname and write the index to indexfile and the
+* file names to namefile.  nthreads (0 for none), update and budget
+* are the -j, -u and -m options, and flags those of the index (-p sets
+* INDEX_POSITIONS).  The work done is added to stats.
+*/
+static void build_index(char *dirname, char *indexfile, char *namefile,
+                        int nthreads, int update, size_t budget, int flags,
+                        Stats *stats) {
+	Dict dict;
+	FileTable files;
+	FileTable scan;
+	struct stat indexstat, namestat;
+	int first = 0;
+	char path[PATHLENGTH];
+	RunList runs;
+	unsigned long long start;
+	int i;
+
+	memset(&runs, 0, sizeof(runs));
+	pthread_mutex_init(&runs.lock, NULL);
+	runs.indexfile = indexfile;
+	runs.budget = budget;
+	runs.flags = flags;
+	init_dict(&dict);
+	dict.positional = (flags & INDEX_POSITIONS) != 0;
+	init_filenames(&files);
+	init_filenames(&scan);
+
+	/* never index our own output */
+	memset(&indexstat, 0, sizeof(indexstat));
+	memset(&namestat, 0, sizeof(namestat));
+	if(stat(indexfile, &indexstat) == -1) {
+		update = 0;
+	}
+	stat(namefile, &namestat);
+
+	DIR *dir;
+	if((dir = opendir(dirname)) == NULL) {
+		perror("opendir");
+		exit(1);
+	}
+	struct dirent *dp;
+	while((dp = readdir(dir)) != NULL) {
+		if(strcmp(dp->d_name, ".") == 0 || strcmp(dp->d_name, "..") == 0 ||
+		    strcmp(dp->d_name, ".svn") == 0) {
+			continue;
+		}
+		if(snprintf(path, PATHLENGTH, "%s/%s", dirname, dp->d_name) >= PATHLENGTH) {
+			fprintf(stderr, "%s/%s: path too long, skipping it\n", dirname, dp->d_name);
+			continue;
+		}
+		if(want_file(path, &indexstat, &namestat)) {
+			add_filename(&scan, path);
+		}
+	}
+	closedir(dir);
+
+	/* with -u, only the files that changed since the last run are read */
+	if(update) {
+		start = stats_clock();
+		first = prepare_update(indexfile, namefile, &scan, &dict, &files);
+		stop_timer(&dict.stats, TIMER_LOAD, start);
+	}
+	if(first == -1) {
+		update = 0;
+		first = 0;
+	}
+	if(!update) {
+		files = scan;
+	}
+	check_budget(&runs, &dict, runs.budget);
+
+	start = stats_clock();
+	if(nthreads > 0) {
+		index_parallel(&dict, &files, first, nthreads, &runs);
+	} else {
+		for(i = first; i < files.count; i++) {
+			printf("Indexing: %s\n", files.names[i]);
+			index_file(&dict, files.names[i], i, &files.info[i]);
+			check_budget(&runs, &dict, runs.budget);
+		}
+	}
+	stop_timer(&dict.stats, TIMER_INDEX, start);
+	if(runs.count > 0) {
+		/* with -m, what is left joins the runs, which are merged */
+		if(dict.count > 0) {
+			spill_dict(&runs, &dict);
+		}
+		start = stats_clock();
+		merge_list(namefile, indexfile, runs.names, runs.count, &files);
+		stop_timer(&dict.stats, TIMER_MERGE, start);
+		for(i = 0; i < runs.count; i++) {
+			unlink(runs.names[i]);
+			free(runs.names[i]);
+		}
+		free(runs.names);
+	} else {
+		start = stats_clock();
+		write_list(namefile, indexfile, sort_list(dict.head), &files, flags);
+		stop_timer(&dict.stats, TIMER_WRITE, start);
+	}
+	add_stats(stats, &dict.stats);
+	pthread_mutex_destroy(&runs.lock);
+	free_dict(&dict);
+	free_filenames(&files);
+	if(update) {
+		free_filenames(&scan);
+	}
+}
+
+/* A child process of index_root building the index of one directory.
+*/
+typedef struct {
+	pid_t pid;
+	int fd;				/* the child writes its Stats here */
+	int shard;
+	unsigned long long start;
+} Builder;
+
+static int compare_names(const void *a, const void *b) {
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Wait for one of the nbuilders running builders to finish, report on
+* it and add its stats to stats.  The finished builder is removed from
+* the array.  Returns 0 if it succeeded and -1 if it did not.
+*/
+static int reap_builder(Builder *builders, int *nbuilders, char **dirs, int ndirs,
+                        int *done, Stats *stats) {
+	Stats child;
+	Builder *b;
+	pid_t pid;
+	int status, i, ok;
+	double seconds, mb;
+
+	if((pid = wait(&status)) == -1) {
+		perror("wait");
+		exit(1);
+	}
+	for(i = 0; i < *nbuilders && builders[i].pid != pid; i++) {
+	}
+	if(i == *nbuilders) {
+		return 0;
+	}
+	b = &builders[i];
+	seconds = (stats_clock() - b->start) / 1e9;
+	ok = WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+		read(b->fd, &child, sizeof(Stats)) == sizeof(Stats);
+	close(b->fd);
+	(*done)++;
+	if(ok) {
+		add_stats(stats, &child);
+		mb = child.counters[STAT_BYTES_READ] / 1e6;
+		printf("[%d/%d] %s: %llu files, %.1f MB in %.2fs (%.1f MB/s)\n",
+			*done, ndirs, dirs[b->shard], child.counters[STAT_FILES], mb,
+			seconds, seconds > 0 ? mb / seconds : 0.0);
+	} else {
+		fprintf(stderr, "[%d/%d] %s: indexer failed\n", *done, ndirs, dirs[b->shard]);
+	}
+	fflush(stdout);
+	*b = builders[--(*nbuilders)];
+	return ok ? 0 : -1;
+}
+
+/* Build the index of every subdirectory of root, as query expects to
+* find them, running up to nprocs indexers at a time.  Each indexer is
+* a child process, so a directory that fails to index (the indexer
+* exits on errors) does not stop the others.  indexfile and namefile
+* name the files written in each subdirectory.  Progress is reported as
+* each directory finishes.  Returns the number of directories that
+* failed.
+*/
+static int index_root(char *root, char *indexfile, char *namefile, int nprocs,
+                      int nthreads, int update, size_t budget, int flags,
+                      Stats *stats) {
+	char path[PATHLENGTH];
+	char **dirs = NULL;
+	int ndirs = 0, maxdirs = 0;
+	Builder *builders;
+	int nbuilders = 0, done = 0, failed = 0;
+	struct stat sbuf;
+	struct dirent *dp;
+	DIR *dir;
+	int fds[2];
+	int i;
+	unsigned long long start = stats_clock();
+	double seconds, mb;
+
+	if((dir = opendir(root)) == NULL) {
+		perror(root);
+		exit(1);
+	}
+	while((dp = readdir(dir)) != NULL) {
+		if(strcmp(dp->d_name, ".") == 0 || strcmp(dp->d_name, "..") == 0 ||
+		    strcmp(dp->d_name, ".svn") == 0) {
+			continue;
+		}
+		if(snprintf(path, PATHLENGTH, "%s/%s", root, dp->d_name) >= PATHLENGTH) {
+			fprintf(stderr, "%s/%s: path too long\n", root, dp->d_name);
+			continue;
+		}
+		if(stat(path, &sbuf) == -1 || !S_ISDIR(sbuf.st_mode)) {
+			continue;
+		}
+		if(ndirs == maxdirs) {
+			maxdirs = (maxdirs == 0) ? 16 : maxdirs * 2;
+			if((dirs = realloc(dirs, maxdirs * sizeof(char *))) == NULL) {
+				perror("malloc");
+				exit(1);
 			}
-			if(*token != '\0') {
+		}
+		if((dirs[ndirs++] = strdup(path)) == NULL) {
+			perror("malloc");
+			exit(1);
+		}
+	}
+	closedir(dir);
+	qsort(dirs, ndirs, sizeof(char *), compare_names);
 
-				head = add_word(head, filenames, token, fname);
+	if((builders = malloc(nprocs * sizeof(Builder))) == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	printf("Indexing %d directories of %s with %d processes\n", ndirs, root, nprocs);
+	fflush(stdout);
+	for(i = 0; i < ndirs; i++) {
+		while(nbuilders == nprocs) {
+			failed -= reap_builder(builders, &nbuilders, dirs, ndirs, &done, stats);
+		}
+		if(pipe(fds) == -1) {
+			perror("pipe");
+			exit(1);
+		}
+		builders[nbuilders].shard = i;
+		builders[nbuilders].start = stats_clock();
+		builders[nbuilders].fd = fds[0];
+		if((builders[nbuilders].pid = fork()) == -1) {
+			perror("fork");
+			exit(1);
+		}
+		if(builders[nbuilders].pid == 0) {
+			Stats child;
+			char indexpath[PATHLENGTH], namepath[PATHLENGTH];
+
+			close(fds[0]);
+			if(snprintf(indexpath, PATHLENGTH, "%s/%s", dirs[i], indexfile) >= PATHLENGTH ||
+			   snprintf(namepath, PATHLENGTH, "%s/%s", dirs[i], namefile) >= PATHLENGTH) {
+				fprintf(stderr, "%s: path too long\n", dirs[i]);
+				exit(1);
+			}
+			/* the per-file progress of the children would interleave */
+			if(freopen("/dev/null", "w", stdout) == NULL) {
+				perror("/dev/null");
+				exit(1);
 			}
+			init_stats(&child);
+			build_index(dirs[i], indexpath, namepath, nthreads, update, budget, flags,
+				&child);
+			if(write(fds[1], &child, sizeof(Stats)) != sizeof(Stats)) {
+				perror("write");
+				exit(1);
+			}
+			exit(0);
 		}
+		close(fds[1]);
+		nbuilders++;
+	}
+	while(nbuilders > 0) {
+		failed -= reap_builder(builders, &nbuilders, dirs, ndirs, &done, stats);
+	}
+
+	seconds = (stats_clock() - start) / 1e9;
+	mb = stats->counters[STAT_BYTES_READ] / 1e6;
+	printf("Indexed %d directories: %llu files, %.1f MB in %.2fs (%.1f MB/s)\n",
+		ndirs - failed, stats->counters[STAT_FILES], mb, seconds,
+		seconds > 0 ? mb / seconds : 0.0);
+	for(i = 0; i < ndirs; i++) {
+		free(dirs[i]);
 	}
-	return head;
+	free(dirs);
+	free(builders);
+	return failed;
 }
 
 int main(int argc, char **argv) {
 
-	Node *head = NULL;
-	char **filenames = init_filenames();
+	Stats stats;
+	int update = 0;
 	char ch;
 	char *indexfile = "index";
 	char *namefile = "filenames";
 	char dirname[PATHLENGTH] = ".";
-	char path[PATHLENGTH];
+	char *root = NULL;
+	int have_dir = 0;
+	int nthreads = 0;
+	int nprocs = 0;
+	int stats_output = 0;
+	int failed = 0;
+	int flags = 0;
+	long megabytes;
+	size_t budget = 0;
 
-	while((ch = getopt(argc, argv, "i:n:d:")) != -1) {
+	while((ch = getopt(argc, argv, "i:n:d:j:um:pr:P:S:")) != -1) {
 		switch (ch) {
 			case 'i':
 			indexfile = optarg;
@@ -70,31 +725,69 @@ int main(int argc, char **argv) {
 			case 'd':
 			strncpy(dirname, optarg, PATHLENGTH);
 			dirname[PATHLENGTH-1] = '\0'; 
+			have_dir = 1;
+			break;
+			case 'j':
+			nthreads = strtol(optarg, NULL, 10);
+			if(nthreads < 1) {
+				fprintf(stderr, "indexer: -j needs a positive number of threads\n");
+				exit(1);
+			}
+			break;
+			case 'u':
+			update = 1;
+			break;
+			case 'm':
+			megabytes = strtol(optarg, NULL, 10);
+			if(megabytes < 1) {
+				fprintf(stderr, "indexer: -m needs a memory budget in megabytes\n");
+				exit(1);
+			}
+			budget = (size_t)megabytes << 20;
+			break;
+			case 'p':
+			flags |= INDEX_POSITIONS;
+			break;
+			case 'r':
+			root = optarg;
+			break;
+			case 'P':
+			nprocs = strtol(optarg, NULL, 10);
+			if(nprocs < 1) {
+				fprintf(stderr, "indexer: -P needs a positive number of processes\n");
+				exit(1);
+			}
+			break;
+			case 'S':
+			if((stats_output = stats_format(optarg)) == 0) {
+				fprintf(stderr, "indexer: -S takes json or prometheus\n");
+				exit(1);
+			}
 			break;
 			default:
-			fprintf(stderr, "Usage: indexer [-i FILE] [-n FILE ] [-d DIRECTORY_NAME]\n");
+			fprintf(stderr, "Usage: indexer [-i FILE] [-n FILE ] [-d DIRECTORY_NAME | -r ROOT [-P PROCESSES]] [-j THREADS] [-u] [-m MEGABYTES] [-p] [-S json|prometheus]\n");
 			exit(1);
 		}
 	}
-	DIR *dir;
-	if((dir = opendir(dirname)) == NULL) {
-		perror("opendir");
+	if(root != NULL && have_dir) {
+		/* -r indexes the subdirectories of ROOT, each in place */
+		fprintf(stderr, "indexer: -d and -r can not be used together\n");
 		exit(1);
 	}
-	struct dirent *dp;
-	while((dp = readdir(dir)) != NULL) {
-		if(strcmp(dp->d_name, ".") == 0 || strcmp(dp->d_name, "..") == 0 ||
-		    strcmp(dp->d_name, ".svn") == 0) {
-			continue;
+	init_stats(&stats);
+	if(root != NULL) {
+		/* with -r, -i and -n name the files written in each subdirectory */
+		if(nprocs == 0 && (nprocs = sysconf(_SC_NPROCESSORS_ONLN)) < 1) {
+			nprocs = 1;
 		}
-		path[0] = '\0';
-		strncpy(path, dirname, PATHLENGTH);
-		strncat(path, "/", PATHLENGTH-strlen(path));
-		strncat(path, dp->d_name, PATHLENGTH-strlen(path));
-		path[PATHLENGTH-1] = '\0';
-		printf("Indexing: %s\n", path);
-		head = index_file(head, path, filenames);
+		failed = index_root(root, indexfile, namefile, nprocs, nthreads, update,
+			budget, flags, &stats);
+	} else {
+		build_index(dirname, indexfile, namefile, nthreads, update, budget, flags,
+			&stats);
+	}
+	if(stats_output) {
+		print_stats(stderr, &stats, stats_output, "indexer");
 	}
-	write_list(namefile, indexfile, head, filenames);
-	return 0;
+	return failed > 0;
 }
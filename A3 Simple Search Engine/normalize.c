@@ -0,0 +1,343 @@
+/* The steps of the normalization pipeline (see normalize.h): the
+* length and digit rules, a stopword filter and the Porter stemmer.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "tokenize.h"
+#include "normalize.h"
+
+#define STOP_BUCKETS 64
+#define STOP_SLOTS 256
+#define STOP_MAXLEN 10      // "yourselves"
+
+/* The stopwords are kept in a perfect hash table: a word's bucket is
+* its FNV-1a hash modulo STOP_BUCKETS, and the word is in the slot given
+* by the hash started from FNV64_OFFSET ^ stop_displace[bucket] instead,
+* modulo STOP_SLOTS.  The displacements were found offline by placing
+* the buckets largest first, each with the first displacement that
+* moves all its words to free slots, so no two stopwords share a slot
+* and a lookup is two hashes and one comparison.  Changing the list
+* means finding the displacements again.
+*/
+static const unsigned char stop_displace[STOP_BUCKETS] = {
+	  1,   1,   0,   4,   2,   1,   1,   2,   1,   0,   1,   0,   1,   1,   0,   1,
+	  1,   2,   5,   1,   1,   1,   5,   1,   2,   1,   1,   1,   1,   6,   2,   1,
+	  0,   1,   2,   4,   1,   0,   1,   3,   3,   1,   1,   3,   0,   1,   1,  10,
+	  4,   3,   1,   0,   0,  12,   1,   3,   1,   7,   2,   1,   2,   0,   4,   4,
+};
+
+static const char *const stop_slots[STOP_SLOTS] = {
+	NULL, NULL, "once", NULL, NULL, "were", NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, "so", NULL, "because", NULL, "same", NULL, "why",
+	"of", "further", NULL, "again", "or", NULL, "they", "themselves",
+	NULL, NULL, NULL, "this", NULL, NULL, "at", "as", "and", "she", NULL,
+	"which", NULL, "just", "these", "both", "to", "yourselves", NULL,
+	NULL, "by", "how", NULL, NULL, NULL, NULL, "has", NULL, "their",
+	NULL, "most", "with", "herself", "his", "a", "hers", "from", "the",
+	NULL, "yours", "through", NULL, NULL, NULL, NULL, NULL, "some",
+	"between", NULL, NULL, "where", NULL, NULL, NULL, NULL, "own",
+	"below", "am", "you", "will", NULL, NULL, NULL, NULL, "do", NULL,
+	"against", NULL, NULL, NULL, NULL, "ours", NULL, "what", NULL,
+	"here", "off", "when", NULL, "on", "having", "any", "then", NULL,
+	"during", NULL, "he", "who", "over", "are", "into", NULL, "until",
+	"nor", "whom", NULL, NULL, "its", NULL, NULL, NULL, NULL, "itself",
+	"we", NULL, "can", NULL, "very", "up", "about", NULL, NULL, "had",
+	NULL, NULL, "down", "yourself", NULL, "myself", NULL, "be", NULL,
+	"been", "would", NULL, NULL, "for", NULL, "above", NULL, "all", NULL,
+	"does", "under", "an", NULL, NULL, NULL, "ourselves", NULL, NULL,
+	"few", NULL, "is", "more", NULL, NULL, "only", NULL, NULL, "her",
+	NULL, NULL, "my", "them", NULL, "while", NULL, "there", "now", NULL,
+	NULL, NULL, NULL, NULL, "in", "if", "it", "those", "other", NULL,
+	"than", NULL, "before", "being", NULL, NULL, "after", NULL, NULL,
+	"theirs", "could", NULL, NULL, "not", NULL, "i", NULL, "him", "our",
+	"out", "too", NULL, "doing", "your", NULL, NULL, NULL, "but", NULL,
+	NULL, NULL, NULL, NULL, NULL, "have", NULL, "no", "that", NULL, NULL,
+	"such", "was", "did", NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	"each", "me", NULL, "himself", "should",
+};
+
+/* Return 1 if the len characters of word are a stopword.
+*/
+int is_stopword(const char *word, int len) {
+	unsigned long long h;
+	const char *stop;
+
+	if(len > STOP_MAXLEN) {
+		return 0;
+	}
+	h = hash_bytes(FNV64_OFFSET, word, len);
+	h = hash_bytes(FNV64_OFFSET ^ stop_displace[h % STOP_BUCKETS], word, len);
+	stop = stop_slots[h % STOP_SLOTS];
+	return stop != NULL && strncmp(stop, word, len) == 0 && stop[len] == '\0';
+}
+
+/* The Porter stemmer, as described in M.F. Porter, "An algorithm for
+* suffix stripping", Program 14(3), 1980, with the two changes of his
+* reference implementation ("bli" becomes "ble" and "logi" becomes
+* "log").  b[0..k] is the word being stemmed; a successful call to ends
+* sets j to the end of the stem before the suffix.
+*/
+typedef struct {
+	char *b;
+	int k;
+	int j;
+} Stemmer;
+
+typedef struct {
+	const char *suffix;
+	const char *replacement;
+} StemRule;
+
+static const StemRule step2_rules[] = {
+	{ "ational", "ate" }, { "tional", "tion" }, { "enci", "ence" },
+	{ "anci", "ance" }, { "izer", "ize" }, { "bli", "ble" },
+	{ "alli", "al" }, { "entli", "ent" }, { "eli", "e" },
+	{ "ousli", "ous" }, { "ization", "ize" }, { "ation", "ate" },
+	{ "ator", "ate" }, { "alism", "al" }, { "iveness", "ive" },
+	{ "fulness", "ful" }, { "ousness", "ous" }, { "aliti", "al" },
+	{ "iviti", "ive" }, { "biliti", "ble" }, { "logi", "log" },
+	{ NULL, NULL }
+};
+
+static const StemRule step3_rules[] = {
+	{ "icate", "ic" }, { "ative", "" }, { "alize", "al" }, { "iciti", "ic" },
+	{ "ical", "ic" }, { "ful", "" }, { "ness", "" },
+	{ NULL, NULL }
+};
+
+static const StemRule step4_rules[] = {
+	{ "al", "" }, { "ance", "" }, { "ence", "" }, { "er", "" }, { "ic", "" },
+	{ "able", "" }, { "ible", "" }, { "ant", "" }, { "ement", "" },
+	{ "ment", "" }, { "ent", "" }, { "ou", "" }, { "ism", "" }, { "ate", "" },
+	{ "iti", "" }, { "ous", "" }, { "ive", "" }, { "ize", "" },
+	{ NULL, NULL }
+};
+
+/* Return 1 if b[i] is a consonant: a letter other than a, e, i, o and
+* u, and other than a y that follows a consonant.
+*/
+static int consonant(Stemmer *z, int i) {
+	switch(z->b[i]) {
+	case 'a': case 'e': case 'i': case 'o': case 'u':
+		return 0;
+	case 'y':
+		return (i == 0) ? 1 : !consonant(z, i - 1);
+	default:
+		return 1;
+	}
+}
+
+/* Return the number of vowel-consonant sequences in b[0..j]: a stem
+* [C](VC)^m[V] has measure m.
+*/
+static int measure(Stemmer *z) {
+	int n = 0;
+	int i = 0;
+
+	while(i <= z->j && consonant(z, i)) {
+		i++;
+	}
+	while(i <= z->j) {
+		while(i <= z->j && !consonant(z, i)) {
+			i++;
+		}
+		if(i > z->j) {
+			break;
+		}
+		n++;
+		while(i <= z->j && consonant(z, i)) {
+			i++;
+		}
+	}
+	return n;
+}
+
+/* Return 1 if b[0..j] contains a vowel.
+*/
+static int vowel_in_stem(Stemmer *z) {
+	int i;
+	for(i = 0; i <= z->j; i++) {
+		if(!consonant(z, i)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Return 1 if b[i-1] and b[i] are the same consonant.
+*/
+static int double_consonant(Stemmer *z, int i) {
+	return i >= 1 && z->b[i] == z->b[i - 1] && consonant(z, i);
+}
+
+/* Return 1 if b[i-2..i] is consonant, vowel, consonant and the second
+* consonant is not w, x or y: this restores an e in words like "hope"
+* and "file" but not in "fail" or "snow".
+*/
+static int cvc(Stemmer *z, int i) {
+	char ch;
+	if(i < 2 || !consonant(z, i) || consonant(z, i - 1) || !consonant(z, i - 2)) {
+		return 0;
+	}
+	ch = z->b[i];
+	return ch != 'w' && ch != 'x' && ch != 'y';
+}
+
+/* Return 1 if b[0..k] ends with suffix, and set j to the end of what
+* comes before it.
+*/
+static int ends(Stemmer *z, const char *suffix) {
+	int len = strlen(suffix);
+	if(len > z->k + 1 || z->b[z->k] != suffix[len - 1] ||
+	   memcmp(z->b + z->k - len + 1, suffix, len) != 0) {
+		return 0;
+	}
+	z->j = z->k - len;
+	return 1;
+}
+
+/* Replace b[j+1..k] with s.  s is never longer than the suffix that was
+* stripped from the word to get there, so it fits in the word.
+*/
+static void set_to(Stemmer *z, const char *s) {
+	int len = strlen(s);
+	memcpy(z->b + z->j + 1, s, len);
+	z->k = z->j + len;
+}
+
+/* Apply the first rule whose suffix the word ends with, if the stem
+* before the suffix has a measure greater than min.
+*/
+static void apply_rules(Stemmer *z, const StemRule *rules, int min) {
+	for(; rules->suffix != NULL; rules++) {
+		if(ends(z, rules->suffix)) {
+			if(measure(z) > min) {
+				set_to(z, rules->replacement);
+			}
+			return;
+		}
+	}
+}
+
+/* Plurals and -ed or -ing: caresses -> caress, ponies -> poni,
+* cats -> cat, agreed -> agree, plastered -> plaster, motoring -> motor,
+* hopping -> hop, filing -> file.
+*/
+static void step1ab(Stemmer *z) {
+	char *b = z->b;
+	if(b[z->k] == 's') {
+		if(ends(z, "sses")) {
+			z->k -= 2;
+		} else if(ends(z, "ies")) {
+			set_to(z, "i");
+		} else if(b[z->k - 1] != 's') {
+			z->k--;
+		}
+	}
+	if(ends(z, "eed")) {
+		if(measure(z) > 0) {
+			z->k--;
+		}
+	} else if((ends(z, "ed") || ends(z, "ing")) && vowel_in_stem(z)) {
+		z->k = z->j;
+		if(ends(z, "at")) {
+			set_to(z, "ate");
+		} else if(ends(z, "bl")) {
+			set_to(z, "ble");
+		} else if(ends(z, "iz")) {
+			set_to(z, "ize");
+		} else if(double_consonant(z, z->k)) {
+			if(b[z->k] != 'l' && b[z->k] != 's' && b[z->k] != 'z') {
+				z->k--;
+			}
+		} else if(measure(z) == 1 && cvc(z, z->k)) {
+			set_to(z, "e");
+		}
+	}
+}
+
+/* A final y becomes i when there is another vowel in the stem.
+*/
+static void step1c(Stemmer *z) {
+	if(ends(z, "y") && vowel_in_stem(z)) {
+		z->b[z->k] = 'i';
+	}
+}
+
+/* -ion after s or t, and the other suffixes of step4_rules, are removed
+* from a stem of measure 2 or more.
+*/
+static void step4(Stemmer *z) {
+	if(ends(z, "ion")) {
+		if(z->j >= 0 && (z->b[z->j] == 's' || z->b[z->j] == 't') &&
+		   measure(z) > 1) {
+			z->k = z->j;
+		}
+		return;
+	}
+	apply_rules(z, step4_rules, 1);
+}
+
+/* Remove a final e, and the second l of a final ll, from stems that
+* are long enough.
+*/
+static void step5(Stemmer *z) {
+	int m;
+	z->j = z->k;
+	if(z->b[z->k] == 'e') {
+		m = measure(z);
+		if(m > 1 || (m == 1 && !cvc(z, z->k - 1))) {
+			z->k--;
+		}
+	}
+	if(z->b[z->k] == 'l' && double_consonant(z, z->k) && measure(z) > 1) {
+		z->k--;
+	}
+}
+
+/* Reduce the len characters of word (in lower case) to their stem in
+* place.  The stem is null-terminated; its length is returned.
+*/
+int stem_word(char *word, int len) {
+	Stemmer z;
+
+	if(len <= 2) {
+		return len;
+	}
+	z.b = word;
+	z.k = len - 1;
+	z.j = 0;
+	step1ab(&z);
+	if(z.k > 0) {
+		step1c(&z);
+		apply_rules(&z, step2_rules, 0);
+		apply_rules(&z, step3_rules, 0);
+		step4(&z);
+		step5(&z);
+	}
+	word[z.k + 1] = '\0';
+	return z.k + 1;
+}
+
+/* Apply the pipeline to the len characters of word, a null-terminated
+* token from the tokenizer or remove_punc.  Returns 0, leaving word as
+* it is, if the word is not indexed; otherwise word is changed in place
+* to the form that is indexed and its new length is returned.
+*/
+int normalize_word(char *word, int len) {
+	if(len < MIN_WORD_LENGTH) {
+		return 0;
+	}
+	if(SKIP_DIGITS && (char_class[(unsigned char)*word] & CH_DIGIT)) {
+		return 0;
+	}
+	if(STOP_WORDS && is_stopword(word, len)) {
+		return 0;
+	}
+	if(STEM_WORDS) {
+		len = stem_word(word, len);
+	}
+	return len;
+}
@@ -0,0 +1,45 @@
+/* The normalization pipeline: after the tokenizer has stripped a token
+* of punctuation and lower-cased it, normalize_word decides whether it
+* is indexed at all and reduces it to the form that is indexed.  The
+* indexer and the query side both use it, so a query word finds the
+* words of the files that normalize the same way.
+*
+* The steps are chosen at compile time, with -D on the gcc command line
+* (NORMALIZE in the Makefile):
+*
+*   MIN_WORD_LENGTH   tokens shorter than this are not indexed
+*   SKIP_DIGITS       if 1, tokens starting with a digit are not indexed
+*   STOP_WORDS        if 1, common English words are not indexed
+*   STEM_WORDS        if 1, words are reduced to their Porter stem
+*
+* By default stopwords are kept and words are not stemmed, so a build
+* that sets nothing indexes and matches words by the original rules:
+* at least four characters, not starting with a digit.
+*
+* NORMALIZE_CONFIG packs the choice into the number the indexer records
+* in the index header, and an index is only searched by a program that
+* was built with the same one.
+*/
+
+#ifndef MIN_WORD_LENGTH
+#define MIN_WORD_LENGTH 4
+#endif
+
+#ifndef SKIP_DIGITS
+#define SKIP_DIGITS 1
+#endif
+
+#ifndef STOP_WORDS
+#define STOP_WORDS 0
+#endif
+
+#ifndef STEM_WORDS
+#define STEM_WORDS 0
+#endif
+
+#define NORMALIZE_CONFIG ((MIN_WORD_LENGTH & 0xff) | (SKIP_DIGITS ? 0x100 : 0) | \
+	(STOP_WORDS ? 0x200 : 0) | (STEM_WORDS ? 0x400 : 0))
+
+int normalize_word(char *word, int len);
+int is_stopword(const char *word, int len);
+int stem_word(char *word, int len);
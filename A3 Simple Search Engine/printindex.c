@@ -3,11 +3,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include "freq_list.h"
+#include "diskindex.h"
 
 int main(int argc, char **argv)
 {
-  Node *head = NULL;
-  char **filenames = init_filenames();
+  DiskIndex index;
+  FileTable files;
   char arg;
   char *listfile = "index";
   char *namefile = "filenames";
@@ -27,8 +28,10 @@ int main(int argc, char **argv)
   }
 
 
-    read_list(listfile, namefile, &head, filenames);
-    display_list(head, filenames);
+    open_index(listfile, &index);
+    init_filenames(&files);
+    read_filenames(namefile, &files);
+    display_index(&index, &files);
 
   return 0;
 }
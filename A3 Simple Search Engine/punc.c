@@ -1,27 +1,31 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
+#include "tokenize.h"
 
+/* Normalize a word the same way the tokenizer does: strip punctuation
+* from the beginning, punctuation and white space from the end, and
+* convert it to lower case.  The word is changed in place; the returned
+* pointer may point past its start.
+*/
 char *remove_punc(char *word) {
-    int i = 0;
+    unsigned char *w = (unsigned char *)word;
+    int i;
 
     /* remove punctuation from the beginning of the word */
-    while(ispunct(*word)) {
-	word++;
+    while(char_class[*w] & CH_PUNCT) {
+	w++;
     }
-    i = 0;
-    while(word[i] != '\0') {
-
-	word[i] = tolower(word[i]);
-	i++;
+    for(i = 0; w[i] != '\0'; i++) {
+	if(char_class[w[i]] & CH_UPPER) {
+	    w[i] += 'a' - 'A';
+	}
     }
 
     /* remove punctuation from the end of the word */
-    i = strlen(word) - 1;
-    while((ispunct(word[i]) || isspace(word[i]))&& i >= 0) {
-	word[i] = '\0';
+    while(i > 0 && (char_class[w[i-1]] & CH_TRAIL)) {
 	i--;
     }
-    return word;
+    w[i] = '\0';
+    return (char *)w;
 }
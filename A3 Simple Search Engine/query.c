@@ -1,184 +1,581 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <signal.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <dirent.h>
 #include "freq_list.h"
+#include "diskindex.h"
+#include "search.h"
 #include "worker.h"
+#include "topk.h"
+#include "cache.h"
+#include "engine.h"
+#include "normalize.h"
 
+#define CACHE_MEGABYTES 64  // default size of the result cache
 
+char *remove_punc(char *);
 
-int main(int argc, char **argv) {
+/* A long-lived worker process serving the index of one subdirectory.
+*/
+typedef struct {
+    char dir[PATHLENGTH];
+    pid_t pid;
+    int request_fd;     // the master writes framed queries here
+    int response_fd;    // and reads FreqRecords back from here
+    int alive;
+    int done;           // the current response has been fully read
+    int partial_bytes;  // bytes of a record split across reads
+    FreqRecord partial;
+    int unread_pos;     // bytes read past the end of a response, which
+    int unread;         // start the next one (batches only)
+    char inbuf[64 * sizeof(FreqRecord)];
+} Worker;
 
-    char ch;
-    char path[PATHLENGTH];
-    char *startdir = ".";
+/* Fork a worker for the index in path.  The worker maps its index once
+* and then answers queries until the master closes its request pipe.
+* The child closes the pipes of the workers started before it so that
+* each worker sees end-of-file as soon as the master closes its pipe.
+*/
+void start_worker(char *path, Worker *workers, int num_workers) {
+    int pc_pipe[2];
+    int cp_pipe[2];
+    pid_t pid;
+    int i;
+    if (pipe(pc_pipe) == -1 || pipe(cp_pipe) == -1) {
+        perror("ERROR: Pipe failed");
+        exit(101);
+    }
+    if ((pid = fork()) == -1) {
+        perror("ERROR: Fork failed");
+        exit(101);
+    } else if (pid == 0) {
+        for (i = 0; i < num_workers; i++) {
+            close(workers[i].request_fd);
+            close(workers[i].response_fd);
+        }
+        close(pc_pipe[1]);
+        close(cp_pipe[0]);
+        run_worker(path, pc_pipe[0], cp_pipe[1]);
+        close(cp_pipe[1]);
+        exit(0);
+    }
+    close(pc_pipe[0]);
+    close(cp_pipe[1]);
+    strcpy(workers[num_workers].dir, path);
+    workers[num_workers].pid = pid;
+    workers[num_workers].request_fd = pc_pipe[1];
+    workers[num_workers].response_fd = cp_pipe[0];
+    workers[num_workers].alive = 1;
+    workers[num_workers].unread = 0;
+}
 
-    while((ch = getopt(argc, argv, "d:")) != -1) {
-        switch (ch) {
-            case 'd':
-                startdir = optarg;
-                break;
-            default:
-                fprintf(stderr, "Usage: queryone [-d DIRECTORY_NAME]\n");
-                exit(1);
+/* Consume the bytes just read from a worker.  Records can be split
+* across reads, so a partial record is carried over in the worker.
+* Returns the number of bytes used, which stops short of n if the
+* response ends before them.
+*/
+int consume_bytes(Worker *worker, char *buf, int n, TopK *results) {
+    int take;
+    int used = 0;
+    while (n > 0 && !worker->done) {
+        take = sizeof(FreqRecord) - worker->partial_bytes;
+        if (take > n) {
+            take = n;
+        }
+        memcpy((char *)&worker->partial + worker->partial_bytes, buf, take);
+        worker->partial_bytes += take;
+        buf += take;
+        n -= take;
+        used += take;
+        if (worker->partial_bytes == sizeof(FreqRecord)) {
+            worker->partial_bytes = 0;
+            if (worker->partial.freq == 0) {
+                worker->done = 1;
+            } else {
+                topk_add(results, &worker->partial);
+            }
         }
     }
-    // Open the directory provided by the user (or current working directory)
-    struct dirent *entry;
-    int num_of_subdir = 0;
-    DIR *dirp;
-    if((dirp = opendir(startdir)) == NULL) {
-        perror("opendir");
+    return used;
+}
+
+/* Collect the answers of every live worker to the query just sent into
+* the bounded heap results.  The workers run concurrently and their responses are read as they
+* arrive (using poll), so a slow worker does not hold up reading from
+* the others.  Bytes read past the end of a worker's response are kept
+* for the next call.
+*/
+void collect_records(Worker *workers, int num_workers, TopK *results) {
+    struct pollfd *fds = malloc(num_workers * sizeof(struct pollfd));
+    int *owner = malloc(num_workers * sizeof(int));
+    int pending = 0;
+    int i, n, used;
+    if (fds == NULL || owner == NULL) {
+        perror("ERROR: Malloc failed");
         exit(1);
     }
-    while ((entry = readdir(dirp))) {
-        if (entry->d_type == DT_DIR) {
-            if(strcmp(entry->d_name, ".") == 0 ||
-               strcmp(entry->d_name, "..") == 0 ||
-               strcmp(entry->d_name, ".svn") == 0){
+    for (i = 0; i < num_workers; i++) {
+        Worker *worker = &workers[i];
+        worker->done = !worker->alive;
+        worker->partial_bytes = 0;
+        if (!worker->done && worker->unread > 0) {
+            used = consume_bytes(worker, worker->inbuf + worker->unread_pos,
+                                 worker->unread, results);
+            worker->unread_pos += used;
+            worker->unread -= used;
+        }
+    }
+    while (1) {
+        pending = 0;
+        for (i = 0; i < num_workers; i++) {
+            if (!workers[i].done) {
+                fds[pending].fd = workers[i].response_fd;
+                fds[pending].events = POLLIN;
+                owner[pending] = i;
+                pending++;
+            }
+        }
+        if (pending == 0) {
+            break;
+        }
+        if (poll(fds, pending, -1) == -1) {
+            perror("poll");
+            exit(1);
+        }
+        for (i = 0; i < pending; i++) {
+            if (fds[i].revents == 0) {
+                continue;
+            }
+            Worker *worker = &workers[owner[i]];
+            if ((n = read(worker->response_fd, worker->inbuf,
+                          sizeof(worker->inbuf))) <= 0) {
+                // The worker exited (e.g. its directory has no index).
+                worker->alive = 0;
+                worker->done = 1;
                 continue;
             }
-            num_of_subdir++;
+            used = consume_bytes(worker, worker->inbuf, n, results);
+            worker->unread_pos = used;
+            worker->unread = n - used;
         }
     }
-    closedir(dirp);
+    free(fds);
+    free(owner);
+}
+
+/* For each entry in startdir, eliminate . and .., and check to make
+* sure that the entry is a directory, then start a worker to serve the
+* index file contained in the directory.  Returns the workers and
+* stores their number in num_workers.
+*/
+Worker *start_workers(char *startdir, int *num_workers) {
+    DIR *dirp;
     if((dirp = opendir(startdir)) == NULL) {
         perror("opendir");
         exit(1);
     }
+    struct dirent *dp;
+    Worker *workers = NULL;
+    int max_workers = 0;
+    char path[PATHLENGTH];
+    *num_workers = 0;
+    while((dp = readdir(dirp)) != NULL) {
+        if(strcmp(dp->d_name, ".") == 0 ||
+           strcmp(dp->d_name, "..") == 0 ||
+           strcmp(dp->d_name, ".svn") == 0){
+            continue;
+        }
+        if (snprintf(path, PATHLENGTH, "%s/%s", startdir, dp->d_name)
+            >= PATHLENGTH) {
+            fprintf(stderr, "%s/%s: path too long\n", startdir, dp->d_name);
+            continue;
+        }
 
+        struct stat sbuf;
+        if(stat(path, &sbuf) == -1) {
+            //This should only fail if we got the path wrong
+            // or we don't have permissions on this entry.
+            perror("ERROR: Stat");
+            exit(1);
+        }
+        // Only start a worker if it is a directory
+        // Otherwise ignore it.
+        if(S_ISDIR(sbuf.st_mode)) {
+            if (*num_workers == max_workers) {
+                max_workers = (max_workers == 0) ? 16 : max_workers * 2;
+                workers = realloc(workers, max_workers * sizeof(Worker));
+                if (workers == NULL) {
+                    perror("ERROR: Malloc failed");
+                    exit(1);
+                }
+            }
+            start_worker(path, workers, *num_workers);
+            (*num_workers)++;
+        }
+    }
+    closedir(dirp);
+    return workers;
+}
 
-    /* For each entry in the directory, eliminate . and .., and check
-     * to make sure that the entry is a directory, then call run_worker
-     * to process the index file contained in the directory.
-     * Note that this implementation of the query engine iterates
-     * sequentially through the directories, and will expect to read
-     * a word from standard input for each index it checks.
-     */
-
-    struct dirent *dp;
-    FreqRecord *master_freq_array = malloc((MAXRECORDS+1)*sizeof(FreqRecord));
-    if (master_freq_array == NULL) {
+/* Connect to a queryd server at socketpath.  The connection is used as
+* a single worker that answers for every index, with the records already
+* merged.
+*/
+Worker *connect_daemon(char *socketpath) {
+    struct sockaddr_un addr;
+    Worker *worker = malloc(sizeof(Worker));
+    int fd;
+    if (worker == NULL) {
         perror("ERROR: Malloc failed");
         exit(1);
     }
-    int *pc_pipe_array[num_of_subdir];
-    int *cp_pipe_array[num_of_subdir];
-    int process_num = 0;
-    int overload = 0;
-    int masterfreq_index = 0;
-    int nbytes;
-    char *buf = malloc(MAXWORD);
-    if (buf == NULL) {
-        perror("ERROR: Malloc failed");
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketpath) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "query: %s: socket path too long\n", socketpath);
         exit(1);
     }
-    pid_t pid;
-    while((nbytes = read(STDIN_FILENO, buf, MAXWORD)) > 0) {
-        while((dp = readdir(dirp)) != NULL) {
+    strcpy(addr.sun_path, socketpath);
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 ||
+        connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        perror(socketpath);
+        exit(1);
+    }
+    memset(worker, 0, sizeof(Worker));
+    strcpy(worker->dir, socketpath);
+    worker->pid = 0;
+    worker->request_fd = fd;
+    worker->response_fd = fd;
+    worker->alive = 1;
+    return worker;
+}
 
-            if(strcmp(dp->d_name, ".") == 0 ||
-               strcmp(dp->d_name, "..") == 0 ||
-               strcmp(dp->d_name, ".svn") == 0){
-                continue;
-            }
-            strncpy(path, startdir, PATHLENGTH);
-            strncat(path, "/", PATHLENGTH - strlen(path) - 1);
-            strncat(path, dp->d_name, PATHLENGTH - strlen(path) - 1);
-
-            struct stat sbuf;
-            if(stat(path, &sbuf) == -1) {
-                //This should only fail if we got the path wrong
-                // or we don't have permissions on this entry.
-                perror("ERROR: Stat");
+static int compare_words(const void *a, const void *b) {
+    return strcmp(a, b);
+}
+
+/* Batch mode: read every word on standard input (one per line), sort
+* them and drop duplicates, and send them to the workers in batches, so
+* that each worker answers a whole batch in one pass over its index.
+* The results are printed in sorted order, each list headed by its word
+* as it was normalized for the index.
+* With an in-process engine the words are simply looked up in turn.
+*/
+void run_batch(Worker *workers, int num_workers, Engine *engine,
+               TopK *results, int flags) {
+    char line[MAXLINE];
+    char *word;
+    char *words = NULL;
+    int num_words = 0, max_words = 0;
+    int i, n, first;
+
+    while (fgets(line, MAXLINE, stdin) != NULL) {
+        trim_query(line);
+        word = line + strspn(line, " \t");
+        if (*word == '\0') {
+            continue;
+        }
+        if (strpbrk(word, " \t") != NULL) {
+            fprintf(stderr, "query: batch mode takes one word per line, not '%s'\n", word);
+            continue;
+        }
+        if (*(word = remove_punc(word)) == '\0') {
+            fprintf(stderr, "query: '%s' is not a word\n", line);
+            continue;
+        }
+        normalize_word(word, strlen(word));
+        if (num_words == max_words) {
+            max_words = (max_words == 0) ? 1024 : max_words * 2;
+            if ((words = realloc(words, (size_t)max_words * MAXWORD)) == NULL) {
+                perror("ERROR: Malloc failed");
                 exit(1);
-            } 
-            
-            // Only call run_worker if it is a directory
-            // Otherwise ignore it.
-            if(S_ISDIR(sbuf.st_mode)) {
-                int pc_pipe[2];
-                int cp_pipe[2];
-                pc_pipe_array[process_num] = pc_pipe;
-                cp_pipe_array[process_num] = cp_pipe;
-                if (pipe(pc_pipe_array[process_num]) == -1) {
-                    perror("ERROR: Pipe failed");
-                    exit(101);
+            }
+        }
+        strncpy(words + (size_t)num_words * MAXWORD, word, MAXWORD);
+        words[(size_t)num_words * MAXWORD + MAXWORD - 1] = '\0';
+        num_words++;
+    }
+
+    qsort(words, num_words, MAXWORD, compare_words);
+    for (i = 0, n = 0; i < num_words; i++) {
+        if (n == 0 || strcmp(words + (size_t)i * MAXWORD,
+                             words + (size_t)(n - 1) * MAXWORD) != 0) {
+            memmove(words + (size_t)n * MAXWORD, words + (size_t)i * MAXWORD, MAXWORD);
+            n++;
+        }
+    }
+    num_words = n;
+
+    for (i = 0; engine != NULL && i < num_words; i++) {
+        reset_topk(results);
+        engine_term(engine, words + (size_t)i * MAXWORD, flags, results);
+        printf("%s:\n", words + (size_t)i * MAXWORD);
+        print_freq_records(topk_sorted(results));
+    }
+    for (first = 0; engine == NULL && first < num_words; first += n) {
+        n = (num_words - first < MAXBATCH) ? num_words - first : MAXBATCH;
+        for (i = 0; i < num_workers; i++) {
+            if (workers[i].alive &&
+                send_batch(workers[i].request_fd, words + (size_t)first * MAXWORD,
+                           n, flags) == -1) {
+                workers[i].alive = 0;
+            }
+        }
+        for (i = first; i < first + n; i++) {
+            reset_topk(results);
+            collect_records(workers, num_workers, results);
+            printf("%s:\n", words + (size_t)i * MAXWORD);
+            print_freq_records(topk_sorted(results));
+        }
+    }
+    fflush(stdout);
+    free(words);
+}
+
+/* The generation of the whole set of indexes: it changes whenever the
+* indexer replaces any of them, which invalidates the cached results.
+*/
+unsigned long long indexes_generation(Worker *workers, int num_workers) {
+    unsigned long long h = 0;
+    int i;
+    for (i = 0; i < num_workers; i++) {
+        h = h * 1099511628211ull + index_generation(workers[i].dir);
+    }
+    return h;
+}
+
+/* Reload the indexes the indexer has replaced and return the generation
+* of the whole set, for the in-process engine.  Its threads are idle
+* between queries, so the shards can be swapped here.
+*/
+unsigned long long refresh_shards(Shard *shards, int num_shards, Stats *stats) {
+    unsigned long long h = 0;
+    int i;
+    for (i = 0; i < num_shards; i++) {
+        reload_shard(&shards[i], stats);
+        h = h * 1099511628211ull + shards[i].generation;
+    }
+    return h;
+}
+
+int main(int argc, char **argv) {
+
+    char ch;
+    char *startdir = ".";
+    int max_results = MAXRECORDS;
+    int flags = 0;
+    int batch = 0;
+    int stats_output = 0;
+    char *socketpath = NULL;
+    long cache_megabytes = CACHE_MEGABYTES;
+    int num_threads = 0;
+
+    while((ch = getopt(argc, argv, "d:k:rc:BS:s:t:")) != -1) {
+        switch (ch) {
+            case 'd':
+                startdir = optarg;
+                break;
+            case 'k':
+                max_results = strtol(optarg, NULL, 10);
+                if (max_results < 1) {
+                    fprintf(stderr, "query: -k needs a positive number\n");
+                    exit(1);
+                }
+                break;
+            case 'r':
+                flags |= QUERY_RANKED;
+                break;
+            case 'c':
+                cache_megabytes = strtol(optarg, NULL, 10);
+                if (cache_megabytes < 0) {
+                    fprintf(stderr, "query: -c needs a size in megabytes\n");
+                    exit(1);
+                }
+                break;
+            case 'B':
+                batch = 1;
+                break;
+            case 's':
+                socketpath = optarg;
+                break;
+            case 't':
+                num_threads = strtol(optarg, NULL, 10);
+                if (num_threads < 1) {
+                    fprintf(stderr, "query: -t needs a positive number\n");
+                    exit(1);
                 }
-                if (pipe(cp_pipe_array[process_num]) == -1) {
-                    perror("ERROR: Pipe failed");
-                    exit(101);
+                break;
+            case 'S':
+                if ((stats_output = stats_format(optarg)) == 0) {
+                    fprintf(stderr, "query: -S takes json or prometheus\n");
+                    exit(1);
                 }
-                write(pc_pipe_array[process_num][1], buf, MAXWORD);
-                if ((pid = fork()) == -1) {
-                    perror("ERROR: Fork failed");
-                    exit(101);
-                } else if (pid == 0) {
-                    close(pc_pipe_array[process_num][1]);
-                    run_worker(path, pc_pipe_array[process_num][0], cp_pipe_array[process_num][1]);
-                    close(cp_pipe_array[process_num][1]);
-                    exit(0);
-                } else {
-                    int status;
-                    waitpid(pid, &status, 0);
-                    if (status  == 0) {
-                        int read_bytes;
-                        close(cp_pipe_array[process_num][1]);
-                        while ((read_bytes = read(cp_pipe_array[process_num][0], &master_freq_array[masterfreq_index], sizeof(FreqRecord))) > 0) {
-                            if (overload == 1) {
-                                masterfreq_index = MAXRECORDS;
-                            }
-                            masterfreq_index++;
-                            if (masterfreq_index > MAXRECORDS - 1) {
-                                FreqRecord *frp = malloc(sizeof(FreqRecord));
-                                if (frp == NULL) {
-                                    perror("ERROR: Malloc failed");
-                                    exit(1);
-                                }
-                                frp->freq = 0;
-                                master_freq_array[MAXRECORDS] = *frp;
-                                overload = 1;
-                                masterfreq_index = MAXRECORDS - 1;
-                            }
-                        }
-                        close(cp_pipe_array[process_num][0]);
-                        close(pc_pipe_array[process_num][0]);
-                        if (overload == 0) {
-                            FreqRecord *frp = malloc(sizeof(FreqRecord));
-                            if (frp == NULL) {
-                                perror("ERROR: Malloc failed");
-                                exit(1);
-                            }
-                            frp->freq = 0;
-                            master_freq_array[masterfreq_index+1] = *frp;
-                        }
-                    }
+                break;
+            default:
+                fprintf(stderr, "Usage: query [-d DIRECTORY_NAME] [-k MAX_RESULTS] [-r]"
+                        " [-c CACHE_MEGABYTES] [-B] [-S json|prometheus]"
+                        " [-s QUERYD_SOCKET | -t THREADS]\n");
+                exit(1);
+        }
+    }
+    if (socketpath != NULL && num_threads > 0) {
+        // queryd holds the indexes, so there are none to search in-process
+        fprintf(stderr, "query: -s and -t can not be used together\n");
+        exit(1);
+    }
+    // A worker that failed to load its index must not kill the master.
+    signal(SIGPIPE, SIG_IGN);
+
+    Worker *workers = NULL;
+    int num_workers = 0;
+    Engine engine;
+    Shard *shards = NULL;
+    int num_shards = 0;
+    if (num_threads > 0) {
+        // Search the indexes in this process instead of in workers.
+        shards = load_shards(startdir, &num_shards, num_threads);
+        start_engine(&engine, shards, num_shards, num_threads, max_results);
+    } else if (socketpath != NULL) {
+        // The daemon has the indexes; it can not tell us when they change.
+        workers = connect_daemon(socketpath);
+        num_workers = 1;
+        cache_megabytes = 0;
+    } else {
+        workers = start_workers(startdir, &num_workers);
+    }
+
+    /* Read one query per line (see search.h for the syntax) and send it
+     * to every worker, then merge the answers, keeping the best
+     * max_results of them.  Merged answers are cached, keyed by the
+     * canonical form of the query, until the indexes change.
+     */
+    TopK results;
+    Cache cache;
+    CacheEntry *entry;
+    FreqRecord *records;
+    long total;
+    char line[MAXLINE];
+    char error[MAXLINE];
+    char key[MAXLINE];
+    QueryNode *tree;
+    unsigned long long generation, start;
+    Stats stats, worker_stats;
+    int i, cacheable;
+    init_stats(&stats);
+    init_topk(&results, max_results);
+    init_cache(&cache, (size_t)cache_megabytes << 20);
+    if (batch) {
+        run_batch(workers, num_workers, num_threads > 0 ? &engine : NULL,
+                  &results, flags);
+    }
+    while (!batch && fgets(line, MAXLINE, stdin) != NULL) {
+        trim_query(line);
+        if (line[0] == '\0') {
+            continue;
+        }
+        // Check the syntax here so that errors are reported once.
+        if ((tree = parse_query(line, error, MAXLINE)) == NULL) {
+            fprintf(stderr, "query: %s\n", error);
+            continue;
+        }
+        cacheable = snprintf(key, MAXLINE, "%d ", flags) < MAXLINE &&
+                    format_query(tree, key + strlen(key), MAXLINE - strlen(key)) != -1;
+        free_query(tree);
+
+        start = stats_clock();
+        entry = NULL;
+        generation = 0;
+        if (num_threads > 0) {
+            generation = refresh_shards(shards, num_shards, &stats);
+        } else if (cacheable && cache.budget > 0) {
+            generation = indexes_generation(workers, num_workers);
+        }
+        if (cacheable && cache.budget > 0) {
+            entry = cache_lookup(&cache, key, generation);
+        }
+        if (entry != NULL) {
+            records = entry->records;
+            total = entry->total;
+        } else if (num_threads > 0) {
+            reset_topk(&results);
+            engine_query(&engine, line, flags, &results);
+            records = topk_sorted(&results);
+            total = results.total;
+            if (cacheable && cache.budget > 0) {
+                cache_insert(&cache, key, generation, records, total);
+            }
+        } else {
+            for (i = 0; i < num_workers; i++) {
+                if (workers[i].alive &&
+                    send_query(workers[i].request_fd, line, flags,
+                               max_results) == -1) {
+                    workers[i].alive = 0;
                 }
-                process_num++;
+            }
+            reset_topk(&results);
+            collect_records(workers, num_workers, &results);
+            records = topk_sorted(&results);
+            total = results.total;
+            if (cacheable && cache.budget > 0) {
+                cache_insert(&cache, key, generation, records, total);
             }
         }
-        process_num = 0;
-        overload = 0;
-        masterfreq_index = 0;
-        sort(master_freq_array);
-        print_freq_records(master_freq_array);
-        free(master_freq_array);
-        master_freq_array = NULL;
-        master_freq_array = malloc((MAXRECORDS+1)*sizeof(FreqRecord));
-        if (master_freq_array == NULL) {
-            perror("ERROR: Malloc failed");
-            exit(1);
+        print_freq_records(records);
+        stop_timer(&stats, TIMER_QUERY, start);
+        // The workers only send the files that can make the cut, so
+        // the total is a lower bound.
+        if (total > max_results) {
+            fprintf(stderr, "query: showing %d of at least %ld matches for %s "
+                    "(use -k to see more)\n", max_results, total, line);
         }
-        free(buf);
-        buf = malloc(MAXWORD);
-        if (buf == NULL) {
-            perror("ERROR: Malloc failed");
-            exit(1);
+        fflush(stdout);
+    }
+    if (stats_output) {
+        // the workers' counters are added to the master's
+        stats.counters[STAT_CACHE_HITS] = cache.hits;
+        stats.counters[STAT_CACHE_MISSES] = cache.misses;
+        for (i = 0; i < num_workers; i++) {
+            if (workers[i].alive &&
+                request_stats(workers[i].request_fd, workers[i].response_fd,
+                              &worker_stats) == 0) {
+                add_stats(&stats, &worker_stats);
+            }
+        }
+        if (num_threads > 0) {
+            engine_stats(&engine, &stats);
+        }
+        print_stats(stderr, &stats, stats_output, "query");
+    } else if (cache.budget > 0 && !batch) {
+        fprintf(stderr, "query: cache: %ld hits, %ld misses, %u entries,"
+                " %zu bytes\n", cache.hits, cache.misses, cache.count,
+                cache.bytes);
+    }
+
+    for (i = 0; i < num_workers; i++) {
+        close(workers[i].request_fd);
+        if (workers[i].pid != 0) {
+            close(workers[i].response_fd);
+        }
+    }
+    for (i = 0; i < num_workers; i++) {
+        if (workers[i].pid != 0) {
+            waitpid(workers[i].pid, NULL, 0);
         }
     }
+    free(workers);
+    if (num_threads > 0) {
+        stop_engine(&engine);
+        free_shards(shards, num_shards);
+    }
+    free_topk(&results);
+    free_cache(&cache);
     return 0;
 }
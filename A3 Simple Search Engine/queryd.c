@@ -0,0 +1,405 @@
+/* queryd: a long-running query server.  It maps the index of every
+* subdirectory of its start directory once and answers queries from
+* any number of clients over a Unix domain socket.  Clients speak the
+* same protocol as query's workers (see worker.h): framed requests, and
+* for each query the merged, sorted records ending with a record with a
+* frequency of 0.
+*
+* The main thread polls the listening socket and the idle client
+* connections; a connection with a request waiting is handed to a fixed
+* pool of threads, which answers that one request and hands the
+* connection back.  Many clients can therefore share a few threads.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include "freq_list.h"
+#include "diskindex.h"
+#include "search.h"
+#include "worker.h"
+#include "topk.h"
+#include "engine.h"
+
+#define QUERYD_THREADS 4
+#define RELOAD_INTERVAL 1   // seconds between checks for new indexes
+#define CLIENT_TIMEOUT 5    // seconds a client has to finish sending a
+                            // request or to read a reply
+
+typedef struct {
+    Shard *shards;
+    int num_shards;
+    int max_results;
+    pthread_rwlock_t index_lock;    // held for writing while reloading
+    pthread_mutex_t reload_lock;
+    time_t last_check;
+
+    int *ready;                     // connections with a request waiting
+    int ready_head;
+    int ready_count;
+    int ready_cap;
+    pthread_mutex_t ready_lock;
+    pthread_cond_t ready_cond;
+    int wake[2];                    // served connections come back here
+
+    Stats stats;
+    pthread_mutex_t stats_lock;
+} Server;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stop(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+/* Reload the indexes that the indexer has replaced, at most once every
+* RELOAD_INTERVAL seconds.  Queries in progress finish on the old
+* mapping first.  An index that can not be loaded (say the indexer is
+* between renaming the index and the file names into place) is left as
+* it was and tried again at the next check.
+*/
+static void refresh_shards(Server *server, Stats *stats) {
+    unsigned long long current;
+    time_t now = time(NULL);
+    int i;
+
+    // one thread checks while the others carry on
+    if (pthread_mutex_trylock(&server->reload_lock) != 0) {
+        return;
+    }
+    if (now - server->last_check < RELOAD_INTERVAL) {
+        pthread_mutex_unlock(&server->reload_lock);
+        return;
+    }
+    server->last_check = now;
+    for (i = 0; i < server->num_shards; i++) {
+        Shard *shard = &server->shards[i];
+        current = index_generation(shard->dir);
+        if (current == 0 || current == shard->generation) {
+            continue;
+        }
+        pthread_rwlock_wrlock(&server->index_lock);
+        if (!reload_shard(shard, stats)) {
+            fprintf(stderr, "queryd: still serving the old index of %s\n",
+                    shard->dir);
+        }
+        pthread_rwlock_unlock(&server->index_lock);
+    }
+    pthread_mutex_unlock(&server->reload_lock);
+}
+
+/* Evaluate a query against every index, merge the records into results
+* and write them to fd.  With exact, query is a normalized batch word and
+* is looked up as it is (see get_term).  Returns -1 if the client has
+* gone.
+*/
+static int answer_query(Server *server, char *query, int flags, int exact,
+                        TopK *results, Stats *stats, int fd) {
+    FreqRecord *frp, *sorted;
+    unsigned long long start = stats_clock();
+    int i, n;
+
+    reset_topk(results);
+    pthread_rwlock_rdlock(&server->index_lock);
+    for (i = 0; i < server->num_shards; i++) {
+        if (exact) {
+            frp = get_term(&server->shards[i].index, &server->shards[i].files,
+                           query, flags);
+        } else {
+            frp = get_query(&server->shards[i].index, &server->shards[i].files,
+                            query, flags, server->max_results);
+        }
+        for (n = 0; frp[n].freq != 0; n++) {
+            topk_add(results, &frp[n]);
+        }
+        free(frp);
+    }
+    pthread_rwlock_unlock(&server->index_lock);
+    n = results->size;
+    sorted = topk_sorted(results);
+    stop_timer(stats, TIMER_LOOKUP, start);
+    stats->counters[STAT_LOOKUPS]++;
+    stats->counters[STAT_RECORDS] += n;
+    return write_full(fd, sorted, (n + 1) * sizeof(FreqRecord));
+}
+
+/* Read one request from the client on fd and answer it.  Returns -1 if
+* the connection should be closed.
+*/
+static int serve_request(Server *server, int fd, TopK *results, Stats *stats) {
+    RequestHeader header;
+    char buf[MAXLINE];
+    char *words;
+    int i, r = 0;
+
+    if (recv_request(fd, &header) != 1) {
+        return -1;
+    }
+    refresh_shards(server, stats);
+    switch (header.type) {
+    case REQUEST_QUERY:
+        if (recv_query(fd, &header, buf) == -1) {
+            return -1;
+        }
+        trim_query(buf);
+        return answer_query(server, buf, header.flags, 0, results, stats, fd);
+    case REQUEST_BATCH:
+        if ((words = recv_batch(fd, &header)) == NULL) {
+            return -1;
+        }
+        for (i = 0; i < header.length && r == 0; i++) {
+            r = answer_query(server, words + i * MAXWORD, header.flags, 1,
+                             results, stats, fd);
+        }
+        free(words);
+        return r;
+    default:
+        pthread_mutex_lock(&server->stats_lock);
+        add_stats(&server->stats, stats);
+        init_stats(stats);
+        r = write_full(fd, &server->stats, sizeof(Stats));
+        pthread_mutex_unlock(&server->stats_lock);
+        return r;
+    }
+}
+
+/* Body of the pool threads: take a connection with a request waiting,
+* answer the request, and give the connection back to the main thread
+* to wait for the next one.
+*/
+static void *serve_thread(void *arg) {
+    Server *server = arg;
+    TopK results;
+    Stats stats;
+    int fd;
+
+    init_topk(&results, server->max_results);
+    init_stats(&stats);
+    while (1) {
+        pthread_mutex_lock(&server->ready_lock);
+        while (server->ready_count == 0) {
+            pthread_cond_wait(&server->ready_cond, &server->ready_lock);
+        }
+        fd = server->ready[server->ready_head];
+        server->ready_head = (server->ready_head + 1) % server->ready_cap;
+        server->ready_count--;
+        pthread_mutex_unlock(&server->ready_lock);
+
+        if (serve_request(server, fd, &results, &stats) == -1) {
+            close(fd);
+        } else if (write_full(server->wake[1], &fd, sizeof(fd)) == -1) {
+            perror("queryd: wake");
+            exit(1);
+        }
+        pthread_mutex_lock(&server->stats_lock);
+        add_stats(&server->stats, &stats);
+        pthread_mutex_unlock(&server->stats_lock);
+        init_stats(&stats);
+    }
+    return NULL;
+}
+
+/* A pool thread blocks reading a request and writing its reply, so a
+* client that stops half way through either must not hold it forever:
+* the read or write times out and the connection is dropped.
+*/
+static void set_timeouts(int fd) {
+    struct timeval timeout;
+    timeout.tv_sec = CLIENT_TIMEOUT;
+    timeout.tv_usec = 0;
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1 ||
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == -1) {
+        perror("setsockopt");
+    }
+}
+
+/* Queue a connection for the pool, growing the queue when it is full.
+*/
+static void enqueue(Server *server, int fd) {
+    pthread_mutex_lock(&server->ready_lock);
+    if (server->ready_count == server->ready_cap) {
+        int cap = (server->ready_cap == 0) ? 16 : server->ready_cap * 2;
+        int *ready = malloc(cap * sizeof(int));
+        int i;
+        if (ready == NULL) {
+            perror("ERROR: Malloc failed");
+            exit(1);
+        }
+        for (i = 0; i < server->ready_count; i++) {
+            ready[i] = server->ready[(server->ready_head + i) % server->ready_cap];
+        }
+        free(server->ready);
+        server->ready = ready;
+        server->ready_head = 0;
+        server->ready_cap = cap;
+    }
+    server->ready[(server->ready_head + server->ready_count) % server->ready_cap] = fd;
+    server->ready_count++;
+    pthread_cond_signal(&server->ready_cond);
+    pthread_mutex_unlock(&server->ready_lock);
+}
+
+int main(int argc, char **argv) {
+    char ch;
+    char *startdir = ".";
+    char *socketpath = "queryd.sock";
+    int nthreads = QUERYD_THREADS;
+    Server server;
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    pthread_t tid;
+    int listenfd, fd, i, j, n;
+
+    memset(&server, 0, sizeof(server));
+    server.max_results = MAXRECORDS;
+    while ((ch = getopt(argc, argv, "d:s:t:k:")) != -1) {
+        switch (ch) {
+            case 'd':
+                startdir = optarg;
+                break;
+            case 's':
+                socketpath = optarg;
+                break;
+            case 't':
+                nthreads = strtol(optarg, NULL, 10);
+                break;
+            case 'k':
+                server.max_results = strtol(optarg, NULL, 10);
+                break;
+            default:
+                fprintf(stderr, "Usage: queryd [-d DIRECTORY_NAME] [-s SOCKET]"
+                        " [-t THREADS] [-k MAX_RESULTS]\n");
+                exit(1);
+        }
+    }
+    if (nthreads < 1 || server.max_results < 1) {
+        fprintf(stderr, "queryd: -t and -k need a positive number\n");
+        exit(1);
+    }
+    if (strlen(socketpath) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "queryd: %s: socket path too long\n", socketpath);
+        exit(1);
+    }
+
+    server.shards = load_shards(startdir, &server.num_shards, nthreads);
+    pthread_rwlock_init(&server.index_lock, NULL);
+    pthread_mutex_init(&server.reload_lock, NULL);
+    pthread_mutex_init(&server.ready_lock, NULL);
+    pthread_cond_init(&server.ready_cond, NULL);
+    pthread_mutex_init(&server.stats_lock, NULL);
+    server.last_check = time(NULL);
+
+    // A client that disconnects early must not kill the server, and
+    // SIGINT or SIGTERM shut it down cleanly (removing the socket).
+    signal(SIGPIPE, SIG_IGN);
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    if ((listenfd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        perror("socket");
+        exit(1);
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socketpath);
+    unlink(socketpath);
+    if (bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(listenfd, 64) == -1) {
+        perror(socketpath);
+        exit(1);
+    }
+    if (pipe(server.wake) == -1) {
+        perror("pipe");
+        exit(1);
+    }
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&tid, NULL, serve_thread, &server) != 0) {
+            fprintf(stderr, "pthread_create failed\n");
+            exit(1);
+        }
+        pthread_detach(tid);
+    }
+    printf("queryd: serving %d indexes on %s with %d threads\n",
+           server.num_shards, socketpath, nthreads);
+    fflush(stdout);
+
+    /* fds[0] is the listening socket, fds[1] the wake pipe, and the rest
+     * the connections that are waiting for their next request. */
+    int num_fds = 2, max_fds = 16;
+    struct pollfd *fds = malloc(max_fds * sizeof(struct pollfd));
+    if (fds == NULL) {
+        perror("ERROR: Malloc failed");
+        exit(1);
+    }
+    fds[0].fd = listenfd;
+    fds[0].events = POLLIN;
+    fds[1].fd = server.wake[0];
+    fds[1].events = POLLIN;
+    while (!stopping) {
+        if (poll(fds, num_fds, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            exit(1);
+        }
+        // Hand the connections with a request waiting to the pool.
+        for (i = 2, j = 2; i < num_fds; i++) {
+            if (fds[i].revents != 0) {
+                enqueue(&server, fds[i].fd);
+            } else {
+                fds[j++] = fds[i];
+            }
+        }
+        num_fds = j;
+
+        int incoming[64];
+        int num_incoming = 0;
+        if (fds[0].revents & POLLIN) {
+            if ((fd = accept(listenfd, NULL, NULL)) == -1) {
+                if (errno != EINTR && errno != ECONNABORTED) {
+                    perror("accept");
+                }
+            } else {
+                set_timeouts(fd);
+                incoming[num_incoming++] = fd;
+            }
+        }
+        if (fds[1].revents & POLLIN) {
+            if ((n = read(server.wake[0], incoming + num_incoming,
+                          (64 - num_incoming) * sizeof(int))) > 0) {
+                num_incoming += n / sizeof(int);
+            }
+        }
+        for (i = 0; i < num_incoming; i++) {
+            if (num_fds == max_fds) {
+                max_fds *= 2;
+                if ((fds = realloc(fds, max_fds * sizeof(struct pollfd))) == NULL) {
+                    perror("ERROR: Malloc failed");
+                    exit(1);
+                }
+            }
+            fds[num_fds].fd = incoming[i];
+            fds[num_fds].events = POLLIN;
+            num_fds++;
+        }
+    }
+
+    unlink(socketpath);
+    printf("queryd: stopped\n");
+    return 0;
+}
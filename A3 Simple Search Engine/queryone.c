@@ -5,27 +5,73 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <pthread.h>
 #include "freq_list.h"
+#include "diskindex.h"
+#include "search.h"
 #include "worker.h"
+#include "topk.h"
+#include "engine.h"
 
+/* With -j, map every subdirectory's index at once, using num_threads
+* threads, and then look up each line of standard input in all of them
+* at the same time.  The records of every index are printed as one
+* list, sorted as query sorts them.
+*/
+static void run_parallel(char *startdir, int num_threads) {
+	char query[MAXLINE];
+	Shard *shards;
+	Engine engine;
+	TopK results;
+	int num_shards, i;
+	int max_results = 1;
 
+	shards = load_shards(startdir, &num_shards, num_threads);
+	// Every match is printed, so keep room for one record per file.
+	for(i = 0; i < num_shards; i++) {
+		max_results += shards[i].files.count;
+	}
+	start_engine(&engine, shards, num_shards, num_threads, max_results);
+	init_topk(&results, max_results);
+	while(fgets(query, MAXLINE, stdin) != NULL) {
+		trim_query(query);
+		reset_topk(&results);
+		engine_query(&engine, query, 0, &results);
+		print_freq_records(topk_sorted(&results));
+	}
+	stop_engine(&engine);
+	free_topk(&results);
+	free_shards(shards, num_shards);
+}
 
 int main(int argc, char **argv) {
 	
 	char ch;
 	char path[PATHLENGTH];
 	char *startdir = ".";
+	int num_threads = 0;
 
-	while((ch = getopt(argc, argv, "d:")) != -1) {
+	while((ch = getopt(argc, argv, "d:j:")) != -1) {
 		switch (ch) {
 			case 'd':
 			startdir = optarg;
 			break;
+			case 'j':
+			num_threads = strtol(optarg, NULL, 10);
+			if(num_threads < 1) {
+				fprintf(stderr, "queryone: -j needs a positive number\n");
+				exit(1);
+			}
+			break;
 			default:
-			fprintf(stderr, "Usage: queryone [-d DIRECTORY_NAME]\n");
+			fprintf(stderr, "Usage: queryone [-d DIRECTORY_NAME] [-j THREADS]\n");
 			exit(1);
 		}
 	}
+	if(num_threads > 0) {
+		run_parallel(startdir, num_threads);
+		return 0;
+	}
 	// Open the directory provided by the user (or current working directory)
 	
 	DIR *dirp;
@@ -35,14 +81,19 @@ int main(int argc, char **argv) {
 	} 
 	
 	/* For each entry in the directory, eliminate . and .., and check
-	* to make sure that the entry is a directory, then call run_worker
-	* to process the index file contained in the directory.
+	* to make sure that the entry is a directory, then load the index
+	* file contained in the directory and look up the next word.
  	* Note that this implementation of the query engine iterates
 	* sequentially through the directories, and will expect to read
-	* a word from standard input for each index it checks.
+	* a word from standard input for each index it checks (-j reads
+	* one query for all of them instead; see run_parallel).
 	*/
 		
 	struct dirent *dp;
+	char word[MAXLINE];
+	DiskIndex diskindex;
+	FileTable files;
+	FreqRecord *frp;
 	while((dp = readdir(dirp)) != NULL) {
 
 		if(strcmp(dp->d_name, ".") == 0 || 
@@ -65,7 +116,16 @@ int main(int argc, char **argv) {
 		// Only call run_worker if it is a directory
 		// Otherwise ignore it.
 		if(S_ISDIR(sbuf.st_mode)) {
-			run_worker(path, STDIN_FILENO, STDOUT_FILENO);
+			if(fgets(word, MAXLINE, stdin) == NULL) {
+				break;
+			}
+			trim_query(word);
+			load_index(path, &diskindex, &files);
+			frp = get_query(&diskindex, &files, word, 0, 0);
+			print_freq_records(frp);
+			free(frp);
+			close_index(&diskindex);
+			free_filenames(&files);
 		}
 		
 	}
@@ -0,0 +1,1493 @@
+/* A small query engine over a mapped index.  Queries are parsed into a
+* tree of QueryNodes and evaluated bottom up into lists of hits sorted
+* by file number.  AND is computed by galloping through the longer list
+* for each hit of the shorter one, so a rare term intersected with a
+* common one costs O(rare * log(common)).  Every hit is scored with
+* BM25, using the document lengths recorded in the index.  Wildcard and
+* fuzzy terms are expanded by walking the sorted terms of the index from
+* the first one that could match, never the whole vocabulary unless the
+* pattern starts with a wildcard.  Phrases are matched by intersecting
+* the positions of their words in each file they all occur in.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <math.h>
+#include <limits.h>
+#include "freq_list.h"
+#include "diskindex.h"
+#include "search.h"
+#include "normalize.h"
+
+#define BM25_K1 1.2
+#define BM25_B 0.75
+
+char *remove_punc(char *);
+
+/* The parser works on a cursor into the query text. */
+typedef struct {
+    char *pos;
+    char token[MAXLINE];
+    char *error;
+    int errlen;
+} Parser;
+
+/* Read the next token: "(", ")", a phrase in double quotes (with any
+* ~N directly after it), or a run of other non-space characters.
+* Returns 0 at the end of the text.
+*/
+static int next_token(Parser *p) {
+    int len = 0;
+    while (isspace((unsigned char)*p->pos)) {
+        p->pos++;
+    }
+    if (*p->pos == '\0') {
+        p->token[0] = '\0';
+        return 0;
+    }
+    if (*p->pos == '(' || *p->pos == ')') {
+        p->token[len++] = *p->pos++;
+    } else if (*p->pos == '"') {
+        p->token[len++] = *p->pos++;
+        while (*p->pos != '\0' && *p->pos != '"' && len < MAXLINE - 2) {
+            p->token[len++] = *p->pos++;
+        }
+        if (*p->pos == '"') {
+            p->token[len++] = *p->pos++;
+        }
+        while (*p->pos != '\0' && !isspace((unsigned char)*p->pos) &&
+               *p->pos != '(' && *p->pos != ')' && len < MAXLINE - 1) {
+            p->token[len++] = *p->pos++;
+        }
+    } else {
+        while (*p->pos != '\0' && !isspace((unsigned char)*p->pos) &&
+               *p->pos != '(' && *p->pos != ')' && len < MAXLINE - 1) {
+            p->token[len++] = *p->pos++;
+        }
+    }
+    p->token[len] = '\0';
+    return 1;
+}
+
+static QueryNode *new_node(int type, QueryNode *left, QueryNode *right) {
+    QueryNode *node = malloc(sizeof(QueryNode));
+    if (node == NULL) {
+        perror("ERROR: Malloc failed");
+        exit(1);
+    }
+    node->type = type;
+    node->word[0] = '\0';
+    node->distance = 0;
+    node->left = left;
+    node->right = right;
+    return node;
+}
+
+static QueryNode *parse_or(Parser *p);
+
+/* Normalize a wildcard pattern the way remove_punc normalizes a word,
+* but keep the wildcards: other punctuation is stripped from both ends
+* and letters are converted to lower case.
+*/
+static char *normalize_pattern(char *token) {
+    int i;
+    while (ispunct((unsigned char)*token) && *token != '*' && *token != '?') {
+        token++;
+    }
+    for (i = 0; token[i] != '\0'; i++) {
+        token[i] = tolower((unsigned char)token[i]);
+    }
+    while (i > 0 && (ispunct((unsigned char)token[i - 1]) ||
+                     isspace((unsigned char)token[i - 1])) &&
+           token[i - 1] != '*' && token[i - 1] != '?') {
+        i--;
+    }
+    token[i] = '\0';
+    return token;
+}
+
+/* A phrase: "word word ..." with an optional ~N.  Words are normalized
+* as the indexer normalizes them; the ones it skips are left out, but
+* still count for the offsets of the words after them.
+*/
+static QueryNode *parse_phrase(Parser *p) {
+    QueryNode *phrase, *term;
+    QueryNode **tail;
+    char *end = strrchr(p->token + 1, '"');
+    char *word, *save;
+    int slop = 0, offset = 0;
+
+    if (end == NULL) {
+        snprintf(p->error, p->errlen, "missing \" in %s", p->token);
+        return NULL;
+    }
+    if (end[1] != '\0') {
+        if (end[1] != '~' || end[2] == '\0' ||
+            strspn(end + 2, "0123456789") != strlen(end + 2)) {
+            snprintf(p->error, p->errlen, "unexpected '%s' after a phrase", end + 1);
+            return NULL;
+        }
+        slop = atoi(end + 2);
+    }
+    *end = '\0';
+    phrase = new_node(QUERY_PHRASE, NULL, NULL);
+    phrase->distance = slop;
+    tail = &phrase->left;
+    for (word = strtok_r(p->token + 1, " \t", &save); word != NULL;
+         word = strtok_r(NULL, " \t", &save)) {
+        // the tokenizer drops tokens that are only punctuation
+        if (*(word = remove_punc(word)) == '\0') {
+            continue;
+        }
+        if (normalize_word(word, strlen(word)) > 0) {
+            term = new_node(QUERY_TERM, NULL, NULL);
+            strncpy(term->word, word, MAXWORD);
+            term->word[MAXWORD - 1] = '\0';
+            term->distance = offset;
+            *tail = term;
+            tail = &term->right;
+        }
+        offset++;
+    }
+    if (phrase->left == NULL) {
+        snprintf(p->error, p->errlen, "no word of the phrase \"%s\" is indexed",
+                 p->token + 1);
+        free_query(phrase);
+        return NULL;
+    }
+    next_token(p);
+    return phrase;
+}
+
+/* A term: a word, a wildcard pattern, a fuzzy word ("word~N") or a
+* phrase.
+*/
+static QueryNode *parse_term(Parser *p) {
+    QueryNode *node;
+    char *word;
+    char *tilde = strrchr(p->token, '~');
+    int type = QUERY_TERM;
+    int distance = 0;
+
+    if (p->token[0] == '"') {
+        return parse_phrase(p);
+    }
+    if (tilde != NULL && tilde > p->token &&
+        strspn(tilde + 1, "0123456789") == strlen(tilde + 1)) {
+        distance = (tilde[1] == '\0') ? MAX_FUZZY : atoi(tilde + 1);
+        if (distance < 1 || distance > MAX_FUZZY) {
+            snprintf(p->error, p->errlen, "'%s': a fuzzy term allows 1 to %d edits",
+                     p->token, MAX_FUZZY);
+            return NULL;
+        }
+        *tilde = '\0';
+        type = QUERY_FUZZY;
+        word = remove_punc(p->token);
+        normalize_word(word, strlen(word));
+    } else if (strpbrk(p->token, "*?") != NULL) {
+        type = QUERY_PATTERN;
+        word = normalize_pattern(p->token);
+        if (strspn(word, "*?") == strlen(word)) {
+            snprintf(p->error, p->errlen, "'%s' is not a word", p->token);
+            return NULL;
+        }
+    } else {
+        // Terms are normalized the same way the indexer normalizes words;
+        // one that it would skip is kept as it is and matches nothing.
+        word = remove_punc(p->token);
+        normalize_word(word, strlen(word));
+    }
+    if (*word == '\0') {
+        snprintf(p->error, p->errlen, "'%s' is not a word", p->token);
+        return NULL;
+    }
+    node = new_node(type, NULL, NULL);
+    strncpy(node->word, word, MAXWORD);
+    node->word[MAXWORD - 1] = '\0';
+    node->distance = distance;
+    next_token(p);
+    return node;
+}
+
+/* unary := NOT unary | ( or ) | term
+*/
+static QueryNode *parse_unary(Parser *p) {
+    QueryNode *node;
+    if (strcmp(p->token, "NOT") == 0) {
+        next_token(p);
+        if ((node = parse_unary(p)) == NULL) {
+            return NULL;
+        }
+        return new_node(QUERY_NOT, node, NULL);
+    }
+    if (strcmp(p->token, "(") == 0) {
+        next_token(p);
+        if ((node = parse_or(p)) == NULL) {
+            return NULL;
+        }
+        if (strcmp(p->token, ")") != 0) {
+            snprintf(p->error, p->errlen, "missing )");
+            free_query(node);
+            return NULL;
+        }
+        next_token(p);
+        return node;
+    }
+    if (p->token[0] == '\0' || strcmp(p->token, ")") == 0 ||
+        strcmp(p->token, "AND") == 0 || strcmp(p->token, "OR") == 0) {
+        snprintf(p->error, p->errlen, "expected a term before '%s'",
+                 p->token[0] == '\0' ? "end of query" : p->token);
+        return NULL;
+    }
+    return parse_term(p);
+}
+
+/* and := unary { [AND] unary }
+*/
+static QueryNode *parse_and(Parser *p) {
+    QueryNode *left, *right;
+    if ((left = parse_unary(p)) == NULL) {
+        return NULL;
+    }
+    while (p->token[0] != '\0' && strcmp(p->token, ")") != 0 &&
+           strcmp(p->token, "OR") != 0) {
+        if (strcmp(p->token, "AND") == 0) {
+            next_token(p);
+        }
+        if ((right = parse_unary(p)) == NULL) {
+            free_query(left);
+            return NULL;
+        }
+        left = new_node(QUERY_AND, left, right);
+    }
+    return left;
+}
+
+/* or := and { OR and }
+*/
+static QueryNode *parse_or(Parser *p) {
+    QueryNode *left, *right;
+    if ((left = parse_and(p)) == NULL) {
+        return NULL;
+    }
+    while (strcmp(p->token, "OR") == 0) {
+        next_token(p);
+        if ((right = parse_and(p)) == NULL) {
+            free_query(left);
+            return NULL;
+        }
+        left = new_node(QUERY_OR, left, right);
+    }
+    return left;
+}
+
+/* Check that NOT is only used to remove files from a positive
+* operand of AND.  Returns 1 if node matches a positive set of files.
+*/
+static int check_negation(QueryNode *node, char *error, int errlen) {
+    switch (node->type) {
+    case QUERY_TERM:
+    case QUERY_PATTERN:
+    case QUERY_FUZZY:
+    case QUERY_PHRASE:
+        return 1;
+    case QUERY_NOT:
+        break;
+    case QUERY_AND:
+        if (node->left->type == QUERY_NOT && node->right->type == QUERY_NOT) {
+            break;
+        }
+        if (node->left->type == QUERY_NOT) {
+            return check_negation(node->left->left, error, errlen) &&
+                   check_negation(node->right, error, errlen);
+        }
+        if (node->right->type == QUERY_NOT) {
+            return check_negation(node->left, error, errlen) &&
+                   check_negation(node->right->left, error, errlen);
+        }
+        return check_negation(node->left, error, errlen) &&
+               check_negation(node->right, error, errlen);
+    case QUERY_OR:
+        return check_negation(node->left, error, errlen) &&
+               check_negation(node->right, error, errlen);
+    }
+    if (error[0] == '\0') {
+        snprintf(error, errlen, "NOT must be combined with a positive term");
+    }
+    return 0;
+}
+
+/* Parse text into a query tree.  On a syntax error, returns NULL and
+* describes the problem in error.
+*/
+QueryNode *parse_query(char *text, char *error, int errlen) {
+    Parser p;
+    QueryNode *query;
+    p.pos = text;
+    p.error = error;
+    p.errlen = errlen;
+    error[0] = '\0';
+    next_token(&p);
+    if ((query = parse_or(&p)) == NULL) {
+        return NULL;
+    }
+    if (p.token[0] != '\0') {
+        snprintf(error, errlen, "unexpected '%s'", p.token);
+        free_query(query);
+        return NULL;
+    }
+    if (!check_negation(query, error, errlen)) {
+        if (error[0] == '\0') {
+            snprintf(error, errlen, "NOT must be combined with a positive term");
+        }
+        free_query(query);
+        return NULL;
+    }
+    return query;
+}
+
+/* Append text to buf at *pos, failing once the buffer is full.
+*/
+static int append(char *buf, int len, int *pos, const char *text) {
+    int n = strlen(text);
+    if (*pos + n >= len) {
+        return -1;
+    }
+    memcpy(buf + *pos, text, n + 1);
+    *pos += n;
+    return 0;
+}
+
+static int format_node(QueryNode *node, char *buf, int len, int *pos) {
+    char distance[16];
+    QueryNode *term;
+    int offset = 0;
+    switch (node->type) {
+    case QUERY_PHRASE:
+        // a word left out of the phrase shows as "_"
+        if (append(buf, len, pos, "\"") == -1) {
+            return -1;
+        }
+        for (term = node->left; term != NULL; term = term->right) {
+            while (offset < term->distance) {
+                if (append(buf, len, pos, offset > 0 ? " _" : "_") == -1) {
+                    return -1;
+                }
+                offset++;
+            }
+            if (append(buf, len, pos, offset > 0 ? " " : "") == -1 ||
+                append(buf, len, pos, term->word) == -1) {
+                return -1;
+            }
+            offset++;
+        }
+        snprintf(distance, sizeof(distance), "\"~%d", node->distance);
+        return append(buf, len, pos, distance);
+    case QUERY_TERM:
+    case QUERY_PATTERN:
+        return append(buf, len, pos, node->word);
+    case QUERY_FUZZY:
+        snprintf(distance, sizeof(distance), "~%d", node->distance);
+        return (append(buf, len, pos, node->word) == -1) ? -1 :
+               append(buf, len, pos, distance);
+    case QUERY_NOT:
+        return (append(buf, len, pos, "NOT ") == -1) ? -1 :
+               format_node(node->left, buf, len, pos);
+    }
+    if (append(buf, len, pos, "(") == -1 ||
+        format_node(node->left, buf, len, pos) == -1 ||
+        append(buf, len, pos, node->type == QUERY_AND ? " AND " : " OR ") == -1 ||
+        format_node(node->right, buf, len, pos) == -1) {
+        return -1;
+    }
+    return append(buf, len, pos, ")");
+}
+
+/* Write the canonical form of a parsed query to buf (of size len):
+* normalized terms and explicit, fully parenthesized operators, so that
+* queries that differ only in case, punctuation, spacing or implicit
+* ANDs come out the same.  Returns -1 if it does not fit.
+*/
+int format_query(QueryNode *query, char *buf, int len) {
+    int pos = 0;
+    if (len < 1) {
+        return -1;
+    }
+    buf[0] = '\0';
+    return format_node(query, buf, len, &pos) == -1 ? -1 : pos;
+}
+
+void free_query(QueryNode *query) {
+    if (query != NULL) {
+        free_query(query->left);
+        free_query(query->right);
+        free(query);
+    }
+}
+
+static Hit *alloc_hits(int n) {
+    Hit *hits = malloc((n > 0 ? n : 1) * sizeof(Hit));
+    if (hits == NULL) {
+        perror("ERROR: Malloc failed");
+        exit(1);
+    }
+    return hits;
+}
+
+void free_hits(HitList *list) {
+    free(list->hits);
+    list->hits = NULL;
+    list->count = 0;
+}
+
+/* The inverse document frequency of something found in df files.
+*/
+static double bm25_idf(DiskIndex *index, int df) {
+    return log(1.0 + (index->header->num_files - df + 0.5) / (df + 0.5));
+}
+
+/* The BM25 score of something that occurs tf times in a file of length
+* words.  It grows with tf and shrinks with length.
+*/
+static double bm25_length(DiskIndex *index, double idf, uint32_t length, double tf) {
+    const IndexHeader *header = index->header;
+    double avgdl = (header->num_files > 0 && header->total_length > 0) ?
+                   (double)header->total_length / header->num_files : 1.0;
+    double norm = 1.0 - BM25_B + BM25_B * length / avgdl;
+    return idf * tf * (BM25_K1 + 1.0) / (tf + BM25_K1 * norm);
+}
+
+/* The BM25 score of something that occurs tf times in file filenum.
+*/
+static double bm25(DiskIndex *index, double idf, int filenum, double tf) {
+    return bm25_length(index, idf, index->files[filenum].length, tf);
+}
+
+/* The hits for a term already found in the index, scored with BM25.
+*/
+HitList postings_hits(DiskIndex *index, const TermInfo *term) {
+    HitList list = { NULL, 0 };
+    PostingCursor cursor;
+    Posting p;
+    double idf = bm25_idf(index, term->num_postings);
+
+    list.hits = alloc_hits(term->num_postings);
+    open_postings(&cursor, term);
+    while (next_posting(&cursor, &p)) {
+        list.hits[list.count].filenum = p.filenum;
+        list.hits[list.count].freq = p.count;
+        list.hits[list.count].score = bm25(index, idf, p.filenum, p.count);
+        list.count++;
+    }
+    return list;
+}
+
+/* The hits for a single term.
+*/
+static HitList term_hits(DiskIndex *index, char *word) {
+    HitList list = { NULL, 0 };
+    TermInfo term;
+
+    if (!find_term(index, word, &term)) {
+        list.hits = alloc_hits(0);
+        return list;
+    }
+    return postings_hits(index, &term);
+}
+
+/* Append the hits of term to all, which has room for *capacity hits.
+*/
+static void add_term_hits(DiskIndex *index, const TermInfo *term, HitList *all,
+                          int *capacity) {
+    HitList list = postings_hits(index, term);
+    if (all->count + list.count > *capacity) {
+        *capacity = 2 * (all->count + list.count);
+        if ((all->hits = realloc(all->hits, *capacity * sizeof(Hit))) == NULL) {
+            perror("ERROR: Malloc failed");
+            exit(1);
+        }
+    }
+    memcpy(all->hits + all->count, list.hits, list.count * sizeof(Hit));
+    all->count += list.count;
+    free_hits(&list);
+}
+
+static int compare_hits(const void *a, const void *b) {
+    return ((const Hit *)a)->filenum - ((const Hit *)b)->filenum;
+}
+
+/* Sort the hits collected from several terms by file, adding up the
+* frequencies and scores of each file, as OR does.
+*/
+static HitList combine_hits(HitList *all) {
+    int i, n = 0;
+    if (all->hits == NULL) {
+        all->hits = alloc_hits(0);
+    }
+    qsort(all->hits, all->count, sizeof(Hit), compare_hits);
+    for (i = 0; i < all->count; i++) {
+        if (n > 0 && all->hits[n - 1].filenum == all->hits[i].filenum) {
+            all->hits[n - 1].freq += all->hits[i].freq;
+            all->hits[n - 1].score += all->hits[i].score;
+        } else {
+            all->hits[n++] = all->hits[i];
+        }
+    }
+    all->count = n;
+    return *all;
+}
+
+/* Match word against pattern, in which '*' matches any run of
+* characters and '?' any one character.
+*/
+static int match_pattern(const char *pattern, const char *word) {
+    const char *star = NULL;
+    const char *retry = NULL;
+    while (*word != '\0') {
+        if (*pattern == '*') {
+            star = pattern++;
+            retry = word;
+        } else if (*pattern == '?' || *pattern == *word) {
+            pattern++;
+            word++;
+        } else if (star != NULL) {
+            pattern = star + 1;
+            word = ++retry;
+        } else {
+            return 0;
+        }
+    }
+    while (*pattern == '*') {
+        pattern++;
+    }
+    return *pattern == '\0';
+}
+
+/* The hits for every term matching a wildcard pattern.  Only the terms
+* that start with the pattern's literal prefix are examined: the walk
+* starts at the block that would hold the prefix and stops at the first
+* term past it, so "comput*" costs as much as the terms it matches.
+*/
+static HitList pattern_hits(DiskIndex *index, const char *pattern) {
+    HitList all = { NULL, 0 };
+    TermIter iter;
+    TermInfo term;
+    char prefix[MAXWORD];
+    int len = strcspn(pattern, "*?");
+    int capacity = 0;
+    int cmp;
+
+    memcpy(prefix, pattern, len);
+    prefix[len] = '\0';
+    seek_terms(&iter, index, find_block(index, prefix));
+    while (next_term(&iter, &term)) {
+        cmp = strncmp(term.word, prefix, len);
+        if (cmp < 0) {
+            continue;
+        } else if (cmp > 0) {
+            break;
+        }
+        if (match_pattern(pattern + len, term.word + len)) {
+            add_term_hits(index, &term, &all, &capacity);
+        }
+    }
+    return combine_hits(&all);
+}
+
+/* The hits for every term within maxdist edits (insertions, deletions
+* or substitutions of a character) of word.  The terms are walked in
+* sorted order keeping one row of the edit distance table per character
+* of the term, so a term reuses the rows of the prefix it shares with
+* the one before it.  Once no entry of a row is within maxdist, no term
+* with that prefix can match, and the walk jumps past all of them to the
+* block holding the next prefix (a Levenshtein automaton evaluated over
+* the sorted terms).
+*/
+static HitList fuzzy_hits(DiskIndex *index, const char *word, int maxdist) {
+    HitList all = { NULL, 0 };
+    TermIter iter;
+    TermInfo term;
+    int rows[MAXWORD][MAXWORD];
+    int rowmin[MAXWORD];
+    char path[MAXWORD];         // the characters the rows were computed for
+    char next[MAXWORD];
+    int wlen = strlen(word);
+    int depth = 0;              // rows 0 to depth are valid
+    int capacity = 0;
+    int i, j, len, dead, cost, best;
+    uint32_t block;
+
+    for (j = 0; j <= wlen; j++) {
+        rows[0][j] = j;
+    }
+    rowmin[0] = 0;
+    seek_terms(&iter, index, 0);
+    while (next_term(&iter, &term)) {
+        len = strlen(term.word);
+        for (i = 0; i < depth && path[i] == term.word[i]; i++) {
+        }
+        depth = i;
+        dead = 0;
+        for (i = 1; i <= len && !dead; i++) {
+            if (i > depth) {
+                path[i - 1] = term.word[i - 1];
+                rows[i][0] = best = i;
+                for (j = 1; j <= wlen; j++) {
+                    cost = rows[i - 1][j - 1] + (word[j - 1] != term.word[i - 1]);
+                    if (rows[i - 1][j] + 1 < cost) {
+                        cost = rows[i - 1][j] + 1;
+                    }
+                    if (rows[i][j - 1] + 1 < cost) {
+                        cost = rows[i][j - 1] + 1;
+                    }
+                    rows[i][j] = cost;
+                    if (cost < best) {
+                        best = cost;
+                    }
+                }
+                rowmin[i] = best;
+                depth = i;
+            }
+            if (rowmin[i] > maxdist) {
+                dead = i;
+            }
+        }
+        if (!dead) {
+            if (rows[len][wlen] <= maxdist) {
+                add_term_hits(index, &term, &all, &capacity);
+            }
+            continue;
+        }
+        // skip to the first term after every term starting with the
+        // dead prefix
+        memcpy(next, term.word, dead);
+        while (dead > 0 && (unsigned char)next[dead - 1] == 0xff) {
+            dead--;
+        }
+        if (dead == 0) {
+            break;
+        }
+        next[dead - 1]++;
+        next[dead] = '\0';
+        block = find_block(index, next);
+        if (block > iter.block) {
+            seek_terms(&iter, index, block);
+        }
+    }
+    return combine_hits(&all);
+}
+
+/* A word of a phrase being matched: its postings and their positions
+* (those of postings[i] start at positions[starts[i]]), and the next
+* posting to look at.
+*/
+typedef struct {
+    int offset;                 // in the phrase
+    Posting *postings;
+    int *starts;
+    int *positions;
+    int count;
+    int next;
+} PhraseTerm;
+
+/* Decode the postings and positions of word into pt.  Returns 0 if the
+* word is not in the index.
+*/
+static int load_phrase_term(DiskIndex *index, const char *word, PhraseTerm *pt) {
+    TermInfo term;
+    PostingCursor postings;
+    PositionCursor positions;
+    int i, total = 0;
+
+    if (!find_term(index, word, &term)) {
+        return 0;
+    }
+    pt->count = term.num_postings;
+    pt->next = 0;
+    pt->postings = malloc(pt->count * sizeof(Posting));
+    pt->starts = malloc(pt->count * sizeof(int));
+    if (pt->postings == NULL || pt->starts == NULL) {
+        perror("ERROR: Malloc failed");
+        exit(1);
+    }
+    open_postings(&postings, &term);
+    for (i = 0; next_posting(&postings, &pt->postings[i]); i++) {
+        pt->starts[i] = total;
+        total += pt->postings[i].count;
+    }
+    if ((pt->positions = malloc((total > 0 ? total : 1) * sizeof(int))) == NULL) {
+        perror("ERROR: Malloc failed");
+        exit(1);
+    }
+    open_positions(&positions, &term);
+    for (i = 0; i < pt->count; i++) {
+        next_positions(&positions, pt->positions + pt->starts[i], pt->postings[i].count);
+    }
+    return 1;
+}
+
+/* Count the occurrences of a phrase of n words in one file, where pos[k]
+* and len[k] are the positions of word k in the file.  An occurrence
+* starts at a position of the first word; each word after it must come
+* after the previous one, at least as far on as in the phrase, and the
+* last one at most slop words further than in the phrase.  Taking the
+* first such position of every word gives the closest match, and the
+* positions taken only move forward as the start does.
+*/
+static int count_phrase(PhraseTerm *terms, int **pos, int *len, int n, int slop) {
+    int at[MAXLINE / 2];
+    int i, k, need, last, matches = 0;
+
+    for (k = 0; k < n; k++) {
+        at[k] = 0;
+    }
+    for (i = 0; i < len[0]; i++) {
+        last = pos[0][i];
+        for (k = 1; k < n; k++) {
+            need = last + terms[k].offset - terms[k - 1].offset;
+            while (at[k] < len[k] && pos[k][at[k]] < need) {
+                at[k]++;
+            }
+            if (at[k] == len[k]) {
+                return matches;
+            }
+            last = pos[k][at[k]];
+        }
+        if (last - pos[0][i] - (terms[n - 1].offset - terms[0].offset) <= slop) {
+            matches++;
+        }
+    }
+    return matches;
+}
+
+/* The hits for a phrase: the files that have all its words, in order
+* and close enough, with the number of times the phrase occurs as the
+* frequency.  An index without positions can not answer a phrase of
+* more than one word, so nothing matches.
+*/
+static HitList phrase_hits(DiskIndex *index, QueryNode *phrase) {
+    HitList out = { NULL, 0 };
+    PhraseTerm *terms;
+    QueryNode *term;
+    int *pos[MAXLINE / 2];
+    int len[MAXLINE / 2];
+    int n = 0, k, i, filenum, found = 1, matches;
+    double idf;
+
+    for (term = phrase->left; term != NULL; term = term->right) {
+        n++;
+    }
+    if (n == 1) {
+        return term_hits(index, phrase->left->word);
+    }
+    out.hits = alloc_hits(0);
+    if (!(index->header->flags & INDEX_POSITIONS)) {
+        return out;
+    }
+    if ((terms = malloc(n * sizeof(PhraseTerm))) == NULL) {
+        perror("ERROR: Malloc failed");
+        exit(1);
+    }
+    for (k = 0, term = phrase->left; k < n; k++, term = term->right) {
+        terms[k].offset = term->distance;
+        if (found && !load_phrase_term(index, term->word, &terms[k])) {
+            found = 0;
+        }
+        if (!found) {
+            terms[k].postings = NULL;
+            terms[k].starts = NULL;
+            terms[k].positions = NULL;
+        }
+    }
+
+    // walk the files of the first word, finding each in the others
+    for (i = 0; found && i < terms[0].count; i++) {
+        filenum = terms[0].postings[i].filenum;
+        for (k = 1; k < n; k++) {
+            while (terms[k].next < terms[k].count &&
+                   terms[k].postings[terms[k].next].filenum < filenum) {
+                terms[k].next++;
+            }
+            if (terms[k].next == terms[k].count) {
+                found = 0;
+                break;
+            }
+            if (terms[k].postings[terms[k].next].filenum != filenum) {
+                break;
+            }
+        }
+        if (!found || k < n) {
+            continue;
+        }
+        for (k = 0; k < n; k++) {
+            int at = (k == 0) ? i : terms[k].next;
+            pos[k] = terms[k].positions + terms[k].starts[at];
+            len[k] = terms[k].postings[at].count;
+        }
+        if ((matches = count_phrase(terms, pos, len, n, phrase->distance)) > 0) {
+            if (out.count % 64 == 0) {
+                if ((out.hits = realloc(out.hits, (out.count + 64) * sizeof(Hit))) == NULL) {
+                    perror("ERROR: Malloc failed");
+                    exit(1);
+                }
+            }
+            out.hits[out.count].filenum = filenum;
+            out.hits[out.count].freq = matches;
+            out.count++;
+        }
+    }
+    idf = bm25_idf(index, out.count);
+    for (i = 0; i < out.count; i++) {
+        out.hits[i].score = bm25(index, idf, out.hits[i].filenum, out.hits[i].freq);
+    }
+    for (k = 0; k < n; k++) {
+        free(terms[k].postings);
+        free(terms[k].starts);
+        free(terms[k].positions);
+    }
+    free(terms);
+    return out;
+}
+
+/* Return the first position at or after lo whose filenum is not less
+* than filenum, by doubling the step and then binary searching.
+*/
+static int gallop(const Hit *hits, int lo, int n, int filenum) {
+    int step = 1;
+    int hi = lo;
+    int mid;
+    while (hi < n && hits[hi].filenum < filenum) {
+        lo = hi + 1;
+        hi += step;
+        step *= 2;
+    }
+    if (hi > n) {
+        hi = n;
+    }
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (hits[mid].filenum < filenum) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Files in both a and b, with frequencies and scores added.
+*/
+static HitList intersect(HitList *a, HitList *b) {
+    HitList out;
+    HitList *small = (a->count <= b->count) ? a : b;
+    HitList *large = (small == a) ? b : a;
+    int i, j = 0;
+    out.hits = alloc_hits(small->count);
+    out.count = 0;
+    for (i = 0; i < small->count && j < large->count; i++) {
+        j = gallop(large->hits, j, large->count, small->hits[i].filenum);
+        if (j < large->count && large->hits[j].filenum == small->hits[i].filenum) {
+            out.hits[out.count] = small->hits[i];
+            out.hits[out.count].freq += large->hits[j].freq;
+            out.hits[out.count].score += large->hits[j].score;
+            out.count++;
+        }
+    }
+    return out;
+}
+
+/* Files in a that are not in b.
+*/
+static HitList difference(HitList *a, HitList *b) {
+    HitList out;
+    int i, j = 0;
+    out.hits = alloc_hits(a->count);
+    out.count = 0;
+    for (i = 0; i < a->count; i++) {
+        j = gallop(b->hits, j, b->count, a->hits[i].filenum);
+        if (j == b->count || b->hits[j].filenum != a->hits[i].filenum) {
+            out.hits[out.count++] = a->hits[i];
+        }
+    }
+    return out;
+}
+
+/* Files in either a or b, with frequencies and scores added.
+*/
+static HitList merge_union(HitList *a, HitList *b) {
+    HitList out;
+    int i = 0, j = 0;
+    out.hits = alloc_hits(a->count + b->count);
+    out.count = 0;
+    while (i < a->count || j < b->count) {
+        if (j == b->count ||
+            (i < a->count && a->hits[i].filenum < b->hits[j].filenum)) {
+            out.hits[out.count++] = a->hits[i++];
+        } else if (i == a->count || b->hits[j].filenum < a->hits[i].filenum) {
+            out.hits[out.count++] = b->hits[j++];
+        } else {
+            out.hits[out.count] = a->hits[i++];
+            out.hits[out.count].freq += b->hits[j].freq;
+            out.hits[out.count].score += b->hits[j++].score;
+            out.count++;
+        }
+    }
+    return out;
+}
+
+/* The candidates that are (keep) or are not (!keep) in the postings of
+* term, with the term's frequency and score added to the ones kept.
+* The postings are skipped through a block at a time, so a few
+* candidates cost little against a term found in many files.
+*/
+static HitList probe_term(DiskIndex *index, const TermInfo *term,
+                          HitList *candidates, int keep) {
+    HitList out;
+    PostingCursor cursor;
+    Posting p;
+    double idf = bm25_idf(index, term->num_postings);
+    int i, more = 1;
+
+    out.hits = alloc_hits(candidates->count);
+    out.count = 0;
+    open_postings(&cursor, term);
+    p.filenum = -1;
+    for (i = 0; i < candidates->count; i++) {
+        const Hit *hit = &candidates->hits[i];
+        if (more && p.filenum < hit->filenum) {
+            more = skip_postings(&cursor, hit->filenum, &p);
+        }
+        if (more && p.filenum == hit->filenum) {
+            if (keep) {
+                out.hits[out.count] = *hit;
+                out.hits[out.count].freq += p.count;
+                out.hits[out.count].score += bm25(index, idf, p.filenum, p.count);
+                out.count++;
+            }
+        } else if (!keep) {
+            out.hits[out.count++] = *hit;
+        }
+    }
+    return out;
+}
+
+/* Evaluate an AND with a term, or a NOT of a term, on one side by
+* evaluating the other side and probing the term's postings for its
+* hits.  When both sides are terms the one in fewer files is decoded.
+* Returns 0 if neither side is such a term.
+*/
+static int probe_and(DiskIndex *index, QueryNode *query, HitList *out) {
+    QueryNode *other, *probe;
+    TermInfo term, other_term;
+    HitList candidates;
+    int keep = 1;
+
+    if (query->left->type == QUERY_NOT || query->right->type == QUERY_NOT) {
+        keep = 0;
+        probe = (query->left->type == QUERY_NOT) ? query->left->left : query->right->left;
+        other = (query->left->type == QUERY_NOT) ? query->right : query->left;
+        if (probe->type != QUERY_TERM) {
+            return 0;
+        }
+    } else if (query->right->type == QUERY_TERM) {
+        probe = query->right;
+        other = query->left;
+    } else if (query->left->type == QUERY_TERM) {
+        probe = query->left;
+        other = query->right;
+    } else {
+        return 0;
+    }
+    if (!find_term(index, probe->word, &term)) {
+        if (keep) {
+            out->hits = alloc_hits(0);
+            out->count = 0;
+        } else {
+            *out = eval_query(index, other);
+        }
+        return 1;
+    }
+    if (keep && other->type == QUERY_TERM) {
+        if (!find_term(index, other->word, &other_term)) {
+            out->hits = alloc_hits(0);
+            out->count = 0;
+            return 1;
+        }
+        if (other_term.num_postings > term.num_postings) {
+            candidates = postings_hits(index, &term);
+            *out = probe_term(index, &other_term, &candidates, keep);
+            free_hits(&candidates);
+            return 1;
+        }
+        candidates = postings_hits(index, &other_term);
+    } else {
+        candidates = eval_query(index, other);
+    }
+    *out = probe_term(index, &term, &candidates, keep);
+    free_hits(&candidates);
+    return 1;
+}
+
+/* Evaluate a query tree (as returned by parse_query) against index.
+*/
+HitList eval_query(DiskIndex *index, QueryNode *query) {
+    HitList left, right, out;
+    if (query->type == QUERY_TERM) {
+        return term_hits(index, query->word);
+    }
+    if (query->type == QUERY_PATTERN) {
+        return pattern_hits(index, query->word);
+    }
+    if (query->type == QUERY_FUZZY) {
+        return fuzzy_hits(index, query->word, query->distance);
+    }
+    if (query->type == QUERY_PHRASE) {
+        return phrase_hits(index, query);
+    }
+    if (query->type == QUERY_AND && probe_and(index, query, &out)) {
+        return out;
+    }
+    if (query->type == QUERY_AND && query->left->type == QUERY_NOT) {
+        left = eval_query(index, query->right);
+        right = eval_query(index, query->left->left);
+        out = difference(&left, &right);
+    } else if (query->type == QUERY_AND && query->right->type == QUERY_NOT) {
+        left = eval_query(index, query->left);
+        right = eval_query(index, query->right->left);
+        out = difference(&left, &right);
+    } else {
+        // parse_query rejects a NOT that is not an operand of AND
+        left = eval_query(index, query->left);
+        right = eval_query(index, query->right);
+        out = (query->type == QUERY_AND) ? intersect(&left, &right)
+                                         : merge_union(&left, &right);
+    }
+    free_hits(&left);
+    free_hits(&right);
+    return out;
+}
+
+/* A term of a query evaluated by top_hits.
+*/
+typedef struct {
+    TermInfo term;
+    PostingCursor cursor;
+    Posting posting;        // the current posting; its filenum is INT_MAX
+                            // once the postings are used up
+    double idf;
+    double bound;           // no posting scores more than this
+    uint32_t block;         // the block of the postings last looked at
+    int block_last;         // the last file of that block, or INT_MAX
+    double block_bound;     // and the most any posting in it scores
+    int last;               // the last file of postings without a
+                            // skip table
+    int ranked;
+} WandTerm;
+
+/* The most a posting with count in a file of length words can add to
+* the measure files are ranked by: the BM25 score for a ranked query,
+* otherwise the count itself.
+*/
+static double posting_bound(DiskIndex *index, WandTerm *t, uint32_t count,
+                            uint32_t length) {
+    if (!t->ranked) {
+        return count;
+    }
+    return bm25_length(index, t->idf, length, count);
+}
+
+/* Move t to its first posting with a file number of at least filenum.
+*/
+static void advance_term(WandTerm *t, int filenum) {
+    if (t->posting.filenum < filenum &&
+        !skip_postings(&t->cursor, filenum, &t->posting)) {
+        t->posting.filenum = INT_MAX;
+    }
+}
+
+/* Look up, without decoding anything, the block of t that would hold
+* filenum, and return the most a posting in it can add.  A term with
+* no posting from filenum on adds nothing.
+*/
+static double block_bound(DiskIndex *index, WandTerm *t, int filenum) {
+    SkipEntry skip;
+    uint32_t block;
+
+    if (t->term.skips == NULL) {
+        t->block_last = (filenum <= t->last) ? t->last : INT_MAX;
+        return (t->block_last == INT_MAX) ? 0.0 : t->bound;
+    }
+    block = find_posting_block(&t->term, t->block, filenum);
+    if (block == num_posting_blocks(&t->term)) {
+        t->block_last = INT_MAX;
+        return 0.0;
+    }
+    if (block != t->block || t->block_last == INT_MAX) {
+        read_skip(&t->term, block, &skip);
+        t->block = block;
+        t->block_last = skip.last_filenum;
+        t->block_bound = posting_bound(index, t, skip.max_count, skip.min_length);
+    }
+    return t->block_bound;
+}
+
+/* Open a term for top_hits, working out the most any of its postings
+* can add.  Returns 0 if the term is not in the index.
+*/
+static int open_wand_term(DiskIndex *index, const char *word, int ranked,
+                          WandTerm *t) {
+    PostingCursor cursor;
+    SkipEntry skip;
+    Posting p;
+    uint32_t i, length;
+
+    if (!find_term(index, word, &t->term)) {
+        return 0;
+    }
+    t->idf = bm25_idf(index, t->term.num_postings);
+    t->ranked = ranked;
+    t->bound = 0.0;
+    if (t->term.skips != NULL) {
+        for (i = 0; i < num_posting_blocks(&t->term); i++) {
+            read_skip(&t->term, i, &skip);
+            t->bound = fmax(t->bound, posting_bound(index, t, skip.max_count,
+                                                    skip.min_length));
+        }
+    } else {
+        // a short list: its only block is summed up by decoding it
+        open_postings(&cursor, &t->term);
+        while (next_posting(&cursor, &p)) {
+            length = index->files[p.filenum].length;
+            t->bound = fmax(t->bound, posting_bound(index, t, p.count, length));
+            t->last = p.filenum;
+        }
+    }
+    t->block = 0;
+    t->block_last = INT_MAX;
+    open_postings(&t->cursor, &t->term);
+    if (!next_posting(&t->cursor, &t->posting)) {
+        t->posting.filenum = INT_MAX;
+    }
+    return 1;
+}
+
+/* The files' scores are added up over the query tree in the same order
+* as eval_query adds them, so that the two give identical scores.
+* leaves holds the hit of each term of the query, in order; a term not
+* in the file has a hit of 0.
+*/
+static void sum_tree(QueryNode *node, const Hit *leaves, int *leaf, Hit *sum) {
+    Hit left, right;
+    if (node->type == QUERY_TERM) {
+        *sum = leaves[(*leaf)++];
+        return;
+    }
+    sum_tree(node->left, leaves, leaf, &left);
+    sum_tree(node->right, leaves, leaf, &right);
+    sum->freq = left.freq + right.freq;
+    sum->score = left.score + right.score;
+}
+
+/* Count the terms of query if it is a term, or terms joined only by
+* the operator type.  Returns -1 otherwise.
+*/
+static int count_terms(QueryNode *query, int type) {
+    int left, right;
+    if (query->type == QUERY_TERM) {
+        return 1;
+    }
+    if (query->type != type ||
+        (left = count_terms(query->left, type)) == -1 ||
+        (right = count_terms(query->right, type)) == -1) {
+        return -1;
+    }
+    return left + right;
+}
+
+static void list_terms(QueryNode *query, QueryNode **terms, int *n) {
+    if (query->type == QUERY_TERM) {
+        terms[(*n)++] = query;
+    } else {
+        list_terms(query->left, terms, n);
+        list_terms(query->right, terms, n);
+    }
+}
+
+/* The best k measures seen so far, in a min-heap: heap[0] is the
+* measure a file has to reach to be among them.
+*/
+typedef struct {
+    double *heap;
+    int size;
+    int k;
+} Threshold;
+
+static double threshold(Threshold *top) {
+    return (top->size < top->k) ? -1.0 : top->heap[0];
+}
+
+static void raise_threshold(Threshold *top, double measure) {
+    int i, child;
+    double tmp;
+    if (top->size < top->k) {
+        i = top->size++;
+        top->heap[i] = measure;
+        while (i > 0 && top->heap[(i - 1) / 2] > top->heap[i]) {
+            tmp = top->heap[i];
+            top->heap[i] = top->heap[(i - 1) / 2];
+            top->heap[(i - 1) / 2] = tmp;
+            i = (i - 1) / 2;
+        }
+        return;
+    }
+    if (measure <= top->heap[0]) {
+        return;
+    }
+    top->heap[0] = measure;
+    i = 0;
+    while ((child = 2 * i + 1) < top->size) {
+        if (child + 1 < top->size && top->heap[child + 1] < top->heap[child]) {
+            child++;
+        }
+        if (top->heap[i] <= top->heap[child]) {
+            break;
+        }
+        tmp = top->heap[i];
+        top->heap[i] = top->heap[child];
+        top->heap[child] = tmp;
+        i = child;
+    }
+}
+
+/* True if a file whose measure is at most bound can not reach the
+* threshold.  Bounds and scores are summed in different orders, so a
+* bound is given a little slack against rounding.
+*/
+static int below(double bound, double threshold) {
+    return bound + bound * 1e-9 < threshold;
+}
+
+static void sort_wand_terms(WandTerm **t, int n) {
+    int i, j;
+    WandTerm *tmp;
+    for (i = 1; i < n; i++) {
+        for (j = i; j > 0 && t[j]->posting.filenum < t[j - 1]->posting.filenum; j--) {
+            tmp = t[j];
+            t[j] = t[j - 1];
+            t[j - 1] = tmp;
+        }
+    }
+}
+
+/* Score the file every term in order[0..n-1] whose current posting is
+* for filenum is found in, append it to out if it can still be among the
+* best, and move those terms on.  terms is in query order.
+*/
+static void score_file(DiskIndex *index, QueryNode *query, WandTerm *terms,
+                       int num_terms, int filenum, Hit *leaves, Threshold *top,
+                       HitList *out) {
+    Hit sum;
+    double measure;
+    int i, leaf = 0;
+
+    for (i = 0; i < num_terms; i++) {
+        WandTerm *t = &terms[i];
+        leaves[i].freq = 0;
+        leaves[i].score = 0.0;
+        if (t->posting.filenum == filenum) {
+            leaves[i].freq = t->posting.count;
+            leaves[i].score = bm25(index, t->idf, filenum, t->posting.count);
+            if (!next_posting(&t->cursor, &t->posting)) {
+                t->posting.filenum = INT_MAX;
+            }
+        }
+    }
+    sum_tree(query, leaves, &leaf, &sum);
+    measure = terms[0].ranked ? sum.score : sum.freq;
+    if (measure >= threshold(top)) {
+        out->hits[out->count].filenum = filenum;
+        out->hits[out->count].freq = sum.freq;
+        out->hits[out->count].score = sum.score;
+        out->count++;
+        raise_threshold(top, measure);
+    }
+}
+
+/* Evaluate an OR of terms for the best k files with block-max WAND.
+* The terms are kept sorted by their current file; the pivot is the
+* first file where the bounds of the terms up to it could reach the
+* threshold, as no file before it can.  Before the pivot is decoded,
+* the bounds of the blocks holding it are checked, and when even they
+* fall short every file up to the end of the first of those blocks is
+* skipped.
+*/
+static void wand_or(DiskIndex *index, QueryNode *query, WandTerm *terms,
+                    WandTerm **order, int n, Hit *leaves, Threshold *top,
+                    HitList *out) {
+    double sum, theta;
+    int i, p, filenum, next;
+
+    while (1) {
+        sort_wand_terms(order, n);
+        theta = threshold(top);
+        sum = 0.0;
+        for (p = 0; p < n && order[p]->posting.filenum != INT_MAX; p++) {
+            sum += order[p]->bound;
+            if (!below(sum, theta)) {
+                break;
+            }
+        }
+        if (p == n || order[p]->posting.filenum == INT_MAX) {
+            return;
+        }
+        filenum = order[p]->posting.filenum;
+        while (p + 1 < n && order[p + 1]->posting.filenum == filenum) {
+            p++;
+        }
+
+        sum = 0.0;
+        next = (p + 1 < n) ? order[p + 1]->posting.filenum : INT_MAX;
+        for (i = 0; i <= p; i++) {
+            sum += block_bound(index, order[i], filenum);
+            if (order[i]->block_last < next) {
+                next = order[i]->block_last + 1;
+            }
+        }
+        if (below(sum, theta)) {
+            for (i = 0; i <= p; i++) {
+                advance_term(order[i], next);
+            }
+        } else if (order[0]->posting.filenum == filenum) {
+            score_file(index, query, terms, n, filenum, leaves, top, out);
+        } else {
+            for (i = 0; i < p; i++) {
+                advance_term(order[i], filenum);
+            }
+        }
+    }
+}
+
+/* Evaluate an AND of terms for the best k files: every term is moved to
+* the furthest file any of them is on, and when the bounds of the
+* blocks holding that file fall short of the threshold the files up to
+* the end of the first of those blocks are skipped.
+*/
+static void wand_and(DiskIndex *index, QueryNode *query, WandTerm *terms,
+                     int n, Hit *leaves, Threshold *top, HitList *out) {
+    double sum;
+    int i, filenum, next, all;
+
+    while (1) {
+        filenum = 0;
+        for (i = 0; i < n; i++) {
+            if (terms[i].posting.filenum > filenum) {
+                filenum = terms[i].posting.filenum;
+            }
+        }
+        if (filenum == INT_MAX) {
+            return;
+        }
+        sum = 0.0;
+        next = INT_MAX;
+        for (i = 0; i < n; i++) {
+            sum += block_bound(index, &terms[i], filenum);
+            if (terms[i].block_last < next) {
+                next = terms[i].block_last + 1;
+            }
+        }
+        if (below(sum, threshold(top))) {
+            for (i = 0; i < n; i++) {
+                advance_term(&terms[i], next);
+            }
+            continue;
+        }
+        all = 1;
+        for (i = 0; i < n; i++) {
+            advance_term(&terms[i], filenum);
+            all = all && terms[i].posting.filenum == filenum;
+        }
+        if (all) {
+            score_file(index, query, terms, n, filenum, leaves, top, out);
+        }
+    }
+}
+
+/* Evaluate a query for its best k files, by score for a QUERY_RANKED
+* query and by frequency otherwise.  An OR or an AND of plain terms is
+* evaluated with block-max WAND, which skips the blocks of postings that
+* can not hold one of the best files; any other query is evaluated in
+* full.  Every file that is among the best k by eval_query is returned,
+* with the same frequency and score, together with the files tied with
+* the kth; others may be left out.  A k of 0 means every file, and so
+* does one that is no smaller than the number of files, since then
+* nothing could be skipped.
+*/
+HitList eval_top_query(DiskIndex *index, QueryNode *query, int flags, int k) {
+    int type = (query->type == QUERY_AND) ? QUERY_AND : QUERY_OR;
+    int num_terms = (k > 0 && (uint32_t)k < index->header->num_files) ?
+                    count_terms(query, type) : -1;
+    QueryNode **nodes;
+    WandTerm *terms;
+    WandTerm **order;
+    Hit *leaves;
+    Threshold top;
+    HitList out = { NULL, 0 };
+    int i, n = 0, max_hits = 0, missing = 0;
+    double theta;
+
+    if (num_terms == -1) {
+        return eval_query(index, query);
+    }
+    nodes = malloc(num_terms * sizeof(QueryNode *));
+    terms = malloc(num_terms * sizeof(WandTerm));
+    order = malloc(num_terms * sizeof(WandTerm *));
+    leaves = malloc(num_terms * sizeof(Hit));
+    top.heap = malloc(k * sizeof(double));
+    if (nodes == NULL || terms == NULL || order == NULL || leaves == NULL ||
+        top.heap == NULL) {
+        perror("ERROR: Malloc failed");
+        exit(1);
+    }
+    top.size = 0;
+    top.k = k;
+    list_terms(query, nodes, &n);
+    for (i = 0; i < num_terms; i++) {
+        if (open_wand_term(index, nodes[i]->word, (flags & QUERY_RANKED) != 0,
+                           &terms[i])) {
+            max_hits += terms[i].term.num_postings;
+        } else {
+            // a term found nowhere adds nothing to a file
+            memset(&terms[i], 0, sizeof(WandTerm));
+            terms[i].ranked = (flags & QUERY_RANKED) != 0;
+            terms[i].posting.filenum = INT_MAX;
+            terms[i].block_last = INT_MAX;
+            missing = 1;
+        }
+        order[i] = &terms[i];
+    }
+
+    out.hits = alloc_hits(max_hits);
+    if (type == QUERY_OR) {
+        wand_or(index, query, terms, order, num_terms, leaves, &top, &out);
+    } else if (!missing) {
+        wand_and(index, query, terms, num_terms, leaves, &top, &out);
+    }
+
+    // drop the files that fell behind the threshold after they were found
+    theta = threshold(&top);
+    for (i = 0, n = 0; i < out.count; i++) {
+        Hit *hit = &out.hits[i];
+        if (((flags & QUERY_RANKED) ? hit->score : hit->freq) >= theta) {
+            out.hits[n++] = *hit;
+        }
+    }
+    out.count = n;
+    free(nodes);
+    free(terms);
+    free(order);
+    free(leaves);
+    free(top.heap);
+    return out;
+}
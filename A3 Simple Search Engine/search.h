@@ -0,0 +1,60 @@
+// search.h expects freq_list.h and diskindex.h to be included first.
+
+// Query language: terms separated by white space are ANDed together;
+// OR, AND and NOT (in capitals) and parentheses can be used to build
+// other queries, e.g.  "whale (ship OR boat) NOT captain".  NOT can only
+// be used to remove files from a positive term, never on its own.
+// A term can also stand for a set of terms: "comput*" is every term
+// starting with "comput", in "wom?n" and "c*ing" '?' matches any one
+// character and '*' any number, and "whale~1" or "whale~2" is every
+// term within 1 or 2 edits of "whale" ("whale~" means "whale~2").  The
+// files matching any term of the set match.
+// A phrase in double quotes, "white whale", matches files in which its
+// words occur in that order next to each other, and "white whale"~N
+// files in which they occur in that order with at most N other words
+// added between them.  Phrases need an index built with indexer -p.
+// Words and fuzzy terms are normalized the way the indexer normalizes
+// the words of the files (see normalize.h), so with stemming "whales"
+// finds "whale"; wildcard patterns are matched against the normalized
+// terms as they are.
+
+#define QUERY_RANKED 1      // order results by BM25 score, not frequency
+
+#define MAX_FUZZY 2         // the most edits a fuzzy term may allow
+
+enum { QUERY_TERM, QUERY_AND, QUERY_OR, QUERY_NOT, QUERY_PATTERN, QUERY_FUZZY,
+       QUERY_PHRASE };
+
+typedef struct query_node {
+	int type;
+	char word[MAXWORD];             // for QUERY_TERM, the pattern for
+	                                // QUERY_PATTERN and QUERY_FUZZY
+	int distance;                   // edits for QUERY_FUZZY, extra words
+	                                // allowed for QUERY_PHRASE, and for
+	                                // a term of a phrase its offset in it
+	struct query_node *left;        // for QUERY_PHRASE, its first term
+	struct query_node *right;       // unused for QUERY_NOT; for a term of
+	                                // a phrase, the next term
+} QueryNode;
+
+// A file matching a query: the total number of occurrences of the
+// query's terms in the file, and its BM25 score.
+typedef struct {
+	int filenum;
+	int freq;
+	double score;
+} Hit;
+
+// Hits are kept sorted by filenum so that they can be merged.
+typedef struct {
+	Hit *hits;
+	int count;
+} HitList;
+
+QueryNode *parse_query(char *text, char *error, int errlen);
+int format_query(QueryNode *query, char *buf, int len);
+void free_query(QueryNode *query);
+HitList eval_query(DiskIndex *index, QueryNode *query);
+HitList eval_top_query(DiskIndex *index, QueryNode *query, int flags, int k);
+HitList postings_hits(DiskIndex *index, const TermInfo *term);
+void free_hits(HitList *list);
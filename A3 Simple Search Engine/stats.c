@@ -0,0 +1,100 @@
+/* Collecting and printing the counters and timers of stats.h, as a
+* JSON object or in the Prometheus text exposition format.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+static const char *counter_names[NUM_STATS] = {
+	"bytes_read", "tokens", "tokens_dropped", "tokens_skipped",
+	"dict_probes", "nodes_allocated", "files_indexed", "runs_spilled",
+	"index_loads", "lookups", "records_returned", "cache_hits",
+	"cache_misses"
+};
+
+static const char *timer_names[NUM_TIMERS] = {
+	"index", "merge", "write", "load", "lookup", "query"
+};
+
+void init_stats(Stats *stats) {
+	memset(stats, 0, sizeof(Stats));
+}
+
+void add_stats(Stats *into, const Stats *from) {
+	int i;
+	for(i = 0; i < NUM_STATS; i++) {
+		into->counters[i] += from->counters[i];
+	}
+	for(i = 0; i < NUM_TIMERS; i++) {
+		into->nanos[i] += from->nanos[i];
+		into->calls[i] += from->calls[i];
+	}
+}
+
+/* A monotonic clock in nanoseconds, for timing a section of code:
+*	start = stats_clock(); ...; stop_timer(stats, TIMER_X, start);
+*/
+unsigned long long stats_clock(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void stop_timer(Stats *stats, int timer, unsigned long long start) {
+	stats->nanos[timer] += stats_clock() - start;
+	stats->calls[timer]++;
+}
+
+/* Return the format named by name ("json" or "prometheus"), or 0 if
+* there is no such format.
+*/
+int stats_format(const char *name) {
+	if(strcmp(name, "json") == 0) {
+		return STATS_JSON;
+	}
+	if(strcmp(name, "prometheus") == 0 || strcmp(name, "prom") == 0) {
+		return STATS_PROMETHEUS;
+	}
+	return 0;
+}
+
+/* Print every counter and timer, labelled with the name of the program
+* they come from.  Timers are reported as total seconds and the number
+* of timed calls.
+*/
+void print_stats(FILE *fp, const Stats *stats, int format, const char *program) {
+	int i;
+
+	if(format == STATS_JSON) {
+		fprintf(fp, "{\"program\": \"%s\", \"counters\": {", program);
+		for(i = 0; i < NUM_STATS; i++) {
+			fprintf(fp, "%s\"%s\": %llu", i > 0 ? ", " : "",
+				counter_names[i], stats->counters[i]);
+		}
+		fprintf(fp, "}, \"timers\": {");
+		for(i = 0; i < NUM_TIMERS; i++) {
+			fprintf(fp, "%s\"%s\": {\"seconds\": %.6f, \"calls\": %llu}",
+				i > 0 ? ", " : "", timer_names[i],
+				stats->nanos[i] / 1e9, stats->calls[i]);
+		}
+		fprintf(fp, "}}\n");
+	} else {
+		for(i = 0; i < NUM_STATS; i++) {
+			fprintf(fp, "# TYPE search_%s_total counter\n", counter_names[i]);
+			fprintf(fp, "search_%s_total{program=\"%s\"} %llu\n",
+				counter_names[i], program, stats->counters[i]);
+		}
+		for(i = 0; i < NUM_TIMERS; i++) {
+			fprintf(fp, "# TYPE search_%s_seconds_total counter\n", timer_names[i]);
+			fprintf(fp, "search_%s_seconds_total{program=\"%s\"} %.6f\n",
+				timer_names[i], program, stats->nanos[i] / 1e9);
+			fprintf(fp, "# TYPE search_%s_calls_total counter\n", timer_names[i]);
+			fprintf(fp, "search_%s_calls_total{program=\"%s\"} %llu\n",
+				timer_names[i], program, stats->calls[i]);
+		}
+	}
+	fflush(fp);
+}
@@ -0,0 +1,47 @@
+// Counters and timers for the hot paths of the indexer and the query
+// engine.  Each thread or process counts into its own Stats, which are
+// added together (add_stats) before they are printed, so counting is a
+// plain increment.
+
+enum {
+    STAT_BYTES_READ,        // bytes of the files indexed
+    STAT_TOKENS,            // tokens produced by the tokenizer
+    STAT_TOKENS_DROPPED,    // tokens that were only punctuation
+    STAT_TOKENS_SKIPPED,    // tokens too short or starting with a digit
+    STAT_DICT_PROBES,       // hash table slots examined by lookup_word
+    STAT_NODES,             // dictionary nodes allocated
+    STAT_FILES,             // files indexed
+    STAT_RUNS,              // sorted runs spilled to disk by indexer -m
+    STAT_INDEX_LOADS,       // indexes mapped by a worker
+    STAT_LOOKUPS,           // queries and batch words answered
+    STAT_RECORDS,           // frequency records returned
+    STAT_CACHE_HITS,
+    STAT_CACHE_MISSES,
+    NUM_STATS
+};
+
+enum {
+    TIMER_INDEX,            // indexing the files (with the -j merge)
+    TIMER_MERGE,            // merging the dictionaries of -j threads
+    TIMER_WRITE,            // writing the index and file names
+    TIMER_LOAD,             // mapping an index (or loading it for -u)
+    TIMER_LOOKUP,           // evaluating queries in a worker
+    TIMER_QUERY,            // answering a query in the master
+    NUM_TIMERS
+};
+
+typedef struct {
+    unsigned long long counters[NUM_STATS];
+    unsigned long long nanos[NUM_TIMERS];
+    unsigned long long calls[NUM_TIMERS];
+} Stats;
+
+#define STATS_JSON 1
+#define STATS_PROMETHEUS 2
+
+void init_stats(Stats *stats);
+void add_stats(Stats *into, const Stats *from);
+unsigned long long stats_clock(void);
+void stop_timer(Stats *stats, int timer, unsigned long long start);
+int stats_format(const char *name);
+void print_stats(FILE *fp, const Stats *stats, int format, const char *program);
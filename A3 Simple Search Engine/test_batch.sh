@@ -0,0 +1,56 @@
+#!/bin/sh
+# Check that query -B gives the same answers whether the indexes are
+# searched by workers, by the in-process engine (-t) or by queryd (-s).
+# Batch words are normalized once by query; none of the three may
+# normalize them again or read them as patterns.  The same is checked
+# with small_query and small_queryd, whose MAXBATCH is smaller than the
+# number of words, so that full batches are sent too.  Run by "make test";
+# make clean test NORMALIZE="-DSTEM_WORDS=1" checks it with stemming.
+
+set -e
+dir=$(mktemp -d)
+daemon=
+trap 'if [ -n "$daemon" ]; then kill $daemon; fi; rm -rf "$dir"' EXIT
+
+for shard in a b c; do
+	mkdir "$dir/$shard"
+done
+echo "They agreed to the agreement after agreeing twice." > "$dir/a/one.txt"
+echo "Nobody agreed; the agreement was agreed later." > "$dir/b/two.txt"
+echo "Patterns such as agre and agreeable are words too." > "$dir/c/three.txt"
+printf 'agreed\nagreement\nagre*\nagreeable\nagree?\nagreed~1\nlater\nnobody\n' > "$dir/words"
+./indexer -r "$dir" >/dev/null
+
+# run_modes QUERY QUERYD NAME: answer the words in the three modes
+run_modes() {
+	./$1 -d "$dir" -B < "$dir/words" > "$dir/$3.workers"
+	./$1 -d "$dir" -t 2 -B < "$dir/words" > "$dir/$3.engine"
+	./$2 -d "$dir" -s "$dir/$3.sock" > /dev/null &
+	daemon=$!
+	i=0
+	while [ ! -S "$dir/$3.sock" ] && [ $i -lt 50 ]; do
+		sleep 0.1
+		i=$((i + 1))
+	done
+	./$1 -s "$dir/$3.sock" -B < "$dir/words" > "$dir/$3.daemon"
+	kill $daemon
+	wait $daemon 2>/dev/null || true
+	daemon=
+}
+
+run_modes query queryd full
+run_modes small_query small_queryd small
+
+if ! grep -q "two.txt" "$dir/full.workers"; then
+	echo "test_batch: 'agreed' was not found" >&2
+	cat "$dir/full.workers" >&2
+	exit 1
+fi
+for mode in full.engine full.daemon small.workers small.engine small.daemon; do
+	if ! cmp -s "$dir/full.workers" "$dir/$mode"; then
+		echo "test_batch: query -B differs with $mode" >&2
+		diff "$dir/full.workers" "$dir/$mode" >&2 || true
+		exit 1
+	fi
+done
+echo "test_batch: passed"
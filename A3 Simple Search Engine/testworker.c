@@ -3,15 +3,19 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include "freq_list.h"
+#include "diskindex.h"
+#include "search.h"
 #include "worker.h"
 
 
 int main(void) {
     char *listfile = "a3-2016/big/books/index";
     char *namefile = "a3-2016/big/books/filenames";
-    Node *head = NULL;
-    char **filenames = init_filenames();
-    read_list(listfile, namefile, &head, filenames);
+    DiskIndex diskindex;
+    FileTable files;
+    open_index(listfile, &diskindex);
+    init_filenames(&files);
+    read_filenames(namefile, &files);
     char buf[MAXWORD];
     read(STDIN_FILENO, buf, MAXWORD);
     int index = 0;
@@ -23,6 +27,6 @@ int main(void) {
         index++;
     }
     buf[last_char_index+1] = '\0';
-    FreqRecord *frp = get_word(head, filenames, buf);
+    FreqRecord *frp = get_word(&diskindex, &files, buf);
     print_freq_records(frp);
 }
\ No newline at end of file
@@ -0,0 +1,164 @@
+/* A single pass, table driven tokenizer.  Splitting a file into words
+* used to take an fgets, a strsep per token and several passes of
+* ispunct/tolower/strlen calls in remove_punc.  Here every byte is
+* classified with one lookup in char_class while the buffer is scanned,
+* and tokens are produced in place.  Lines of any length are handled,
+* since the file is not read line by line.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "tokenize.h"
+
+#define D CH_DELIM
+#define P CH_PUNCT
+#define T CH_TRAIL
+#define U CH_UPPER
+#define N CH_DIGIT
+
+/* The classes of the ASCII characters, matching isspace/ispunct in the
+* C locale.  Bytes from 128 up are ordinary word characters.
+*/
+const unsigned char char_class[256] = {
+	D, 0, 0, 0, 0, 0, 0, 0, 0, D|T, D|T, T, T, T, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	D|T, P|T, P|T, P|T, P|T, P|T, P|T, P|T, P|T, P|T, P|T, P|T, P|T, P|T, P|T, P|T,
+	N, N, N, N, N, N, N, N, N, N, P|T, P|T, P|T, P|T, P|T, P|T,
+	P|T, U, U, U, U, U, U, U, U, U, U, U, U, U, U, U,
+	U, U, U, U, U, U, U, U, U, U, U, P|T, P|T, P|T, P|T, P|T,
+	P|T, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, P|T, P|T, P|T, P|T, 0,
+};
+
+#undef D
+#undef P
+#undef T
+#undef U
+#undef N
+
+/* Continue an FNV-1a hash over n more bytes.
+*/
+unsigned long long hash_bytes(unsigned long long h, const char *buf, size_t n) {
+	size_t i;
+	for(i = 0; i < n; i++) {
+		h ^= (unsigned char)buf[i];
+		h *= FNV64_PRIME;
+	}
+	return h;
+}
+
+/* Open fname for tokenizing.  Returns -1 (with errno set) if the file
+* cannot be opened.
+*/
+int open_tokenizer(Tokenizer *t, char *fname) {
+	if((t->fd = open(fname, O_RDONLY)) == -1) {
+		return -1;
+	}
+	if((t->buf = malloc(TOKEN_BUFSIZE + 1)) == NULL) {
+		perror("open_tokenizer:");
+		exit(1);
+	}
+	t->len = 0;
+	t->pos = 0;
+	t->eof = 0;
+	t->bytes = 0;
+	t->dropped = 0;
+	t->hash = FNV64_OFFSET;
+	return 0;
+}
+
+void close_tokenizer(Tokenizer *t) {
+	close(t->fd);
+	free(t->buf);
+	t->buf = NULL;
+}
+
+/* Append as much of the file as fits to the buffer.  Returns the number
+* of bytes read; 0 means the end of the file.
+*/
+static int fill(Tokenizer *t) {
+	int n;
+	while((n = read(t->fd, t->buf + t->len, TOKEN_BUFSIZE - t->len)) == -1) {
+		perror("read");
+		exit(1);
+	}
+	if(n == 0) {
+		t->eof = 1;
+		return 0;
+	}
+	t->hash = hash_bytes(t->hash, t->buf + t->len, n);
+	t->bytes += n;
+	t->len += n;
+	return n;
+}
+
+/* Return the next token of the file, or NULL at the end of the file.
+* A token is a run of characters between delimiters, with punctuation
+* removed from its start, punctuation and white space removed from its
+* end, and converted to lower case.  The token is null-terminated and
+* lives in the tokenizer's buffer until the next call; its length is
+* stored in len.
+*/
+char *next_token(Tokenizer *t, int *len) {
+	unsigned char *b = (unsigned char *)t->buf;
+	int start, end, i;
+
+	while(1) {
+		while(t->pos < t->len && (char_class[b[t->pos]] & CH_DELIM)) {
+			t->pos++;
+		}
+		if(t->pos == t->len) {
+			t->pos = t->len = 0;
+			if(t->eof || fill(t) == 0) {
+				return NULL;
+			}
+			continue;
+		}
+
+		start = t->pos;
+		while(t->pos < t->len && !(char_class[b[t->pos]] & CH_DELIM)) {
+			t->pos++;
+		}
+		if(t->pos == t->len && !t->eof) {
+			/* the token may continue in the next block of the file */
+			if(start > 0) {
+				memmove(b, b + start, t->len - start);
+				t->len -= start;
+			}
+			t->pos = 0;
+			if(t->len < TOKEN_BUFSIZE && fill(t) > 0) {
+				continue;
+			}
+			/* at the end of the file, or if the token fills the
+			 * whole buffer, the token ends here */
+			start = 0;
+			t->pos = t->len;
+		}
+		end = t->pos;
+		if(t->pos < t->len) {
+			t->pos++;       /* skip the delimiter */
+		}
+
+		while(start < end && (char_class[b[start]] & CH_PUNCT)) {
+			start++;
+		}
+		while(end > start && (char_class[b[end - 1]] & CH_TRAIL)) {
+			end--;
+		}
+		if(start == end) {
+			t->dropped++;
+			continue;
+		}
+		for(i = start; i < end; i++) {
+			if(char_class[b[i]] & CH_UPPER) {
+				b[i] += 'a' - 'A';
+			}
+		}
+		b[end] = '\0';
+		*len = end - start;
+		return (char *)b + start;
+	}
+}
@@ -0,0 +1,36 @@
+// Character classes used by the tokenizer and by remove_punc.
+
+#define CH_DELIM 1      // separates tokens: space, tab, newline, NUL
+#define CH_PUNCT 2      // stripped from the start of a token
+#define CH_TRAIL 4      // stripped from the end of a token
+#define CH_UPPER 8      // converted to lower case
+#define CH_DIGIT 16
+
+#ifndef TOKEN_BUFSIZE
+#define TOKEN_BUFSIZE (256 * 1024)
+#endif
+
+extern const unsigned char char_class[256];
+
+// Reads a file through one large buffer and splits it into tokens in
+// place: each token is stripped of punctuation, lower-cased and
+// null-terminated inside the buffer, so no token is ever copied.
+
+typedef struct {
+	int fd;
+	char *buf;                  // TOKEN_BUFSIZE + 1 bytes
+	int len;                    // bytes of data in buf
+	int pos;                    // next byte to scan
+	int eof;
+	long long bytes;            // bytes read so far
+	long long dropped;          // tokens that were only punctuation
+	unsigned long long hash;    // FNV-1a hash of the bytes read so far
+} Tokenizer;
+
+#define FNV64_OFFSET 14695981039346656037ull
+#define FNV64_PRIME 1099511628211ull
+
+unsigned long long hash_bytes(unsigned long long h, const char *buf, size_t n);
+int open_tokenizer(Tokenizer *t, char *fname);
+char *next_token(Tokenizer *t, int *len);
+void close_tokenizer(Tokenizer *t);
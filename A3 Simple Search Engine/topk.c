@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "freq_list.h"
+#include "diskindex.h"
+#include "search.h"
+#include "worker.h"
+#include "topk.h"
+
+/* Order records by score, then frequency, breaking ties by file name so
+* that the output does not depend on the order the workers answered in.
+* Returns a positive number if a ranks ahead of b.
+*/
+int compare_records(const FreqRecord *a, const FreqRecord *b) {
+    if (a->score != b->score) {
+        return (a->score > b->score) ? 1 : -1;
+    }
+    if (a->freq != b->freq) {
+        return (a->freq > b->freq) ? 1 : -1;
+    }
+    return strncmp(b->filename, a->filename, PATHLENGTH);
+}
+
+/* Initialize an empty heap that keeps at most k records.  One extra
+* slot is allocated for the terminating record added by topk_sorted.
+*/
+void init_topk(TopK *topk, int k) {
+    if ((topk->heap = malloc((k + 1) * sizeof(FreqRecord))) == NULL) {
+        perror("ERROR: Malloc failed");
+        exit(1);
+    }
+    topk->capacity = k;
+    reset_topk(topk);
+}
+
+void reset_topk(TopK *topk) {
+    topk->size = 0;
+    topk->total = 0;
+}
+
+static void swap_records(FreqRecord *a, FreqRecord *b) {
+    FreqRecord tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+/* Restore the heap property below position i in a heap of n records.
+*/
+static void sift_down(FreqRecord *heap, int n, int i) {
+    int child;
+    while ((child = 2 * i + 1) < n) {
+        if (child + 1 < n && compare_records(&heap[child + 1], &heap[child]) < 0) {
+            child++;
+        }
+        if (compare_records(&heap[child], &heap[i]) >= 0) {
+            break;
+        }
+        swap_records(&heap[i], &heap[child]);
+        i = child;
+    }
+}
+
+/* Offer a record to the heap.  O(log K).
+*/
+void topk_add(TopK *topk, const FreqRecord *record) {
+    int i, parent;
+    topk->total++;
+    if (topk->capacity == 0) {
+        return;
+    }
+    if (topk->size < topk->capacity) {
+        i = topk->size++;
+        topk->heap[i] = *record;
+        while (i > 0) {
+            parent = (i - 1) / 2;
+            if (compare_records(&topk->heap[i], &topk->heap[parent]) >= 0) {
+                break;
+            }
+            swap_records(&topk->heap[i], &topk->heap[parent]);
+            i = parent;
+        }
+    } else if (compare_records(record, &topk->heap[0]) > 0) {
+        topk->heap[0] = *record;
+        sift_down(topk->heap, topk->size, 0);
+    }
+}
+
+/* Sort the kept records best first (a heap sort, in place) and return
+* them as an array terminated by a record with a frequency of 0, as
+* expected by print_freq_records.  The heap is left empty.
+*/
+FreqRecord *topk_sorted(TopK *topk) {
+    int n = topk->size;
+    while (n > 1) {
+        swap_records(&topk->heap[0], &topk->heap[n - 1]);
+        n--;
+        sift_down(topk->heap, n, 0);
+    }
+    topk->heap[topk->size].freq = 0;
+    topk->size = 0;
+    return topk->heap;
+}
+
+void free_topk(TopK *topk) {
+    free(topk->heap);
+    topk->heap = NULL;
+}
@@ -0,0 +1,19 @@
+// topk.h expects worker.h (for FreqRecord) to be included first.
+
+// A bounded min-heap that keeps the best K records offered to it.
+// The worst record kept is at the root, so a new record only has to be
+// compared against the root to know whether it makes the cut.
+
+typedef struct {
+	FreqRecord *heap;
+	int size;
+	int capacity;
+	long total;     // number of records offered so far
+} TopK;
+
+int compare_records(const FreqRecord *a, const FreqRecord *b);
+void init_topk(TopK *topk, int k);
+void reset_topk(TopK *topk);
+void topk_add(TopK *topk, const FreqRecord *record);
+FreqRecord *topk_sorted(TopK *topk);
+void free_topk(TopK *topk);
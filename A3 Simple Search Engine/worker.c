@@ -3,74 +3,194 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <sys/stat.h>
 #include "freq_list.h"
+#include "diskindex.h"
+#include "search.h"
 #include "worker.h"
+#include "tokenize.h"
+#include "normalize.h"
 
-void sort(FreqRecord *frps) { 
-    if (frps[0].freq == 0 || frps[1].freq == 0) { 
-        return; 
-    } 
-    int i = 1; 
-    while (i < MAXRECORDS && frps[i].freq != 0) {
-        FreqRecord current = frps[i];
-        int j = i -1; 
-        while (j >= 0 && frps[j].freq < current.freq) {
-            frps[j + 1] = frps[j]; 
-            j = j - 1; 
-        } 
-        frps[j + 1] = current; 
-        i++; 
-    }
-}
-
-/* The function get_word should be added to this file */
-FreqRecord *get_word(Node *head, char **filename, char *word) {
-    FreqRecord *freqRecords = malloc (MAXRECORDS*sizeof(FreqRecord));
+/* Return an array of frequency records, one for each file in which word
+* occurs, terminated by a record with a frequency of 0.  The array is
+* sized to the word's postings list, so any number of files is allowed.
+*/
+FreqRecord *get_word(DiskIndex *index, FileTable *files, char *word) {
+    TermInfo term;
+    PostingCursor cursor;
+    Posting posting;
+    int num_records = 0;
+    if (find_term(index, word, &term)) {
+        num_records = term.num_postings;
+    }
+    FreqRecord *freqRecords = malloc((num_records + 1) * sizeof(FreqRecord));
     if (freqRecords == NULL) {
         perror("ERROR: Malloc failed");
-        exit(256);
-    }
-    Node *curr = head;
-    int index = 0;
-    int frp_index = 0;
-    int last_record_index = 0;
-    while (curr != NULL) {
-        if (strcmp(curr->word, word) == 0) {
-            while (index < MAXFILES) {
-                if (curr->freq[index] == 0) {
-                    index++;
-                } else {
-                    FreqRecord *freqRecord = malloc (sizeof(FreqRecord));
-                    if (freqRecord == NULL) {
-                        perror("ERROR: Malloc failed");
-                        exit(256);
-                    }
-                    freqRecord->freq = curr->freq[index];
-                    strcpy(freqRecord->filename, filename[index]);
-                    freqRecords[frp_index] = *freqRecord;
-                    last_record_index = frp_index;
-                    frp_index++;
-                    index++;
-                }
-            }
-            curr = NULL;
-        } else {
-            curr = curr->next;
+        exit(1);
+    }
+    int i = 0;
+    if (num_records > 0) {
+        open_postings(&cursor, &term);
+        for (i = 0; next_posting(&cursor, &posting); i++) {
+            freqRecords[i].freq = posting.count;
+            freqRecords[i].score = posting.count;
+            strncpy(freqRecords[i].filename, files->names[posting.filenum],
+                    PATHLENGTH);
+            freqRecords[i].filename[PATHLENGTH - 1] = '\0';
         }
     }
-    FreqRecord *freqRecord = malloc (sizeof(FreqRecord));
-    if (freqRecord == NULL) {
+    freqRecords[i].freq = 0;
+    return freqRecords;
+}
+
+/* Turn a list of hits into frequency records (see get_query) and free
+* the hits.
+*/
+static FreqRecord *hits_to_records(FileTable *files, HitList *list, int flags) {
+    HitList hits = *list;
+    FreqRecord *freqRecords = malloc((hits.count + 1) * sizeof(FreqRecord));
+    if (freqRecords == NULL) {
         perror("ERROR: Malloc failed");
-        exit(256);
+        exit(1);
+    }
+    int i;
+    for (i = 0; i < hits.count; i++) {
+        freqRecords[i].freq = hits.hits[i].freq;
+        freqRecords[i].score = (flags & QUERY_RANKED) ?
+                               hits.hits[i].score : hits.hits[i].freq;
+        strncpy(freqRecords[i].filename, files->names[hits.hits[i].filenum],
+                PATHLENGTH);
+        freqRecords[i].filename[PATHLENGTH - 1] = '\0';
     }
-    freqRecord->freq = 0;
-    freqRecords[last_record_index+1] = *freqRecord;
-    index = 0;
-    frp_index = 0;
-    last_record_index = 0;
+    freqRecords[hits.count].freq = 0;
+    free_hits(list);
     return freqRecords;
 }
 
+/* Evaluate a query (see search.h) and return an array of frequency
+* records, one for each matching file, terminated by a record with a
+* frequency of 0.  With QUERY_RANKED in flags the records are scored
+* with BM25, otherwise by their frequency.  With a positive limit only
+* the best limit records (and those tied with the last of them) are
+* sure to be returned, which lets eval_top_query skip most of the
+* postings of common terms.  A query that does not parse matches
+* nothing.
+*/
+FreqRecord *get_query(DiskIndex *index, FileTable *files, char *query, int flags,
+                      int limit) {
+    char error[MAXLINE];
+    QueryNode *tree = parse_query(query, error, MAXLINE);
+    HitList hits = { NULL, 0 };
+    if (tree != NULL) {
+        hits = eval_top_query(index, tree, flags, limit);
+        free_query(tree);
+    }
+    return hits_to_records(files, &hits, flags);
+}
+
+/* Return the frequency records (as for get_query) of the files that hold
+* word, which is looked up exactly as the index stores it.  Batch mode
+* uses this: its words have been normalized already, so they must not be
+* normalized again, nor parsed as patterns or fuzzy terms.
+*/
+FreqRecord *get_term(DiskIndex *index, FileTable *files, char *word, int flags) {
+    TermInfo term;
+    HitList hits = { NULL, 0 };
+    if (find_term(index, word, &term)) {
+        hits = postings_hits(index, &term);
+    }
+    return hits_to_records(files, &hits, flags);
+}
+
+/* Map the index found in dirname and read its file names.  The index
+* must have been built with the normalization pipeline queries are
+* normalized with here, and the file names must be the ones written
+* with it: the indexer renames the two into place one after the other,
+* so a reader can come between them.  Returns 0, or -1 (after saying
+* why) with nothing loaded; a reader that already has an index should
+* keep it and try again later.
+*/
+int try_load_index(char *dirname, DiskIndex *index, FileTable *files) {
+    char listfile[PATHLENGTH];
+    char namefile[PATHLENGTH];
+    snprintf(listfile, PATHLENGTH, "%s/index", dirname);
+    snprintf(namefile, PATHLENGTH, "%s/filenames", dirname);
+    if (map_index(listfile, index) == -1) {
+        return -1;
+    }
+    init_filenames(files);
+    if (load_filenames(namefile, files) == -1) {
+        free_filenames(files);
+        close_index(index);
+        return -1;
+    }
+    if ((uint32_t)files->count != index->header->num_files ||
+        filenames_hash(files) != index->header->names_hash) {
+        fprintf(stderr, "%s: index and filenames do not match\n", dirname);
+    } else if (index->header->normalize != NORMALIZE_CONFIG) {
+        fprintf(stderr, "%s: index was built with a different normalization"
+                " (re-run indexer)\n", dirname);
+    } else {
+        return 0;
+    }
+    free_filenames(files);
+    close_index(index);
+    return -1;
+}
+
+/* Like try_load_index, for a program that can not go on without the
+* index.
+*/
+void load_index(char *dirname, DiskIndex *index, FileTable *files) {
+    if (try_load_index(dirname, index, files) == -1) {
+        exit(1);
+    }
+}
+
+/* Replace the index and file names loaded from dirname with the ones
+* there now.  If they can not be loaded (the indexer may be half way
+* through replacing them) the old ones are kept, and -1 is returned so
+* that the caller tries again later.
+*/
+int reload_index(char *dirname, DiskIndex *index, FileTable *files) {
+    DiskIndex new_index;
+    FileTable new_files;
+    if (try_load_index(dirname, &new_index, &new_files) == -1) {
+        return -1;
+    }
+    close_index(index);
+    free_filenames(files);
+    *index = new_index;
+    *files = new_files;
+    return 0;
+}
+
+/* Return a number that identifies the current version of the index in
+* dirname, or 0 if it has none.  The indexer writes a new index and
+* file names to temporary files and renames them into place, so a new
+* version shows up as a new inode (and modification time) for them.
+*/
+unsigned long long index_generation(char *dirname) {
+    static const char *names[] = { "index", "filenames" };
+    char path[PATHLENGTH];
+    struct stat sbuf;
+    unsigned long long h = FNV64_OFFSET;
+    long long fields[5];
+    int i;
+    for (i = 0; i < 2; i++) {
+        snprintf(path, PATHLENGTH, "%s/%s", dirname, names[i]);
+        if (stat(path, &sbuf) == -1) {
+            return 0;
+        }
+        fields[0] = sbuf.st_dev;
+        fields[1] = sbuf.st_ino;
+        fields[2] = sbuf.st_size;
+        fields[3] = sbuf.st_mtim.tv_sec;
+        fields[4] = sbuf.st_mtim.tv_nsec;
+        h = hash_bytes(h, (char *)fields, sizeof(fields));
+    }
+    return h;
+}
 
 /* Print to standard output the frequency records for a word.
 * Used for testing.
@@ -83,41 +203,303 @@ void print_freq_records(FreqRecord *frp) {
 	}
 }
 
+/* Read exactly n bytes from fd, retrying short reads.  Returns n, 0 if
+* the other end was closed before anything was read, or -1 on an error
+* or a stream that ends in the middle of a frame.
+*/
+int read_full(int fd, void *buf, int n) {
+    int got = 0;
+    int r;
+    while (got < n) {
+        if ((r = read(fd, (char *)buf + got, n - got)) == -1) {
+            perror("read");
+            return -1;
+        }
+        if (r == 0) {
+            return (got == 0) ? 0 : -1;
+        }
+        got += r;
+    }
+    return got;
+}
+
+/* Write all n bytes of buf to fd, retrying short writes.  Returns 0 on
+* success and -1 if the write failed (for example because the reader
+* has exited).
+*/
+int write_full(int fd, const void *buf, int n) {
+    int done = 0;
+    int w;
+    while (done < n) {
+        if ((w = write(fd, (const char *)buf + done, n - done)) == -1) {
+            return -1;
+        }
+        done += w;
+    }
+    return 0;
+}
+
+/* Requests sent to a worker are framed as a RequestHeader followed by
+* header.length bytes of query text.  Returns -1 if the worker is gone.
+*/
+int send_query(int fd, char *query, int flags, int limit) {
+    RequestHeader header;
+    header.type = REQUEST_QUERY;
+    header.flags = flags;
+    header.length = strlen(query);
+    header.limit = limit;
+    if (write_full(fd, &header, sizeof(header)) == -1 ||
+        write_full(fd, query, header.length) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Send a batch of num_words words, stored MAXWORD bytes apart in words
+* in sorted order without duplicates.  The worker answers with the
+* records for each word in turn, each list ending with a record with a
+* frequency of 0.  Returns -1 if the worker is gone.
+*/
+int send_batch(int fd, char *words, int num_words, int flags) {
+    RequestHeader header;
+    header.type = REQUEST_BATCH;
+    header.flags = flags;
+    header.length = num_words;
+    header.limit = 0;
+    if (write_full(fd, &header, sizeof(header)) == -1 ||
+        write_full(fd, words, num_words * MAXWORD) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Ask a worker for its counters: send a stats request on fd_out and
+* read the answer from fd_in.  Returns -1 if the worker is gone.
+*/
+int request_stats(int fd_out, int fd_in, Stats *stats) {
+    RequestHeader header;
+    header.type = REQUEST_STATS;
+    header.flags = 0;
+    header.length = 0;
+    header.limit = 0;
+    if (write_full(fd_out, &header, sizeof(header)) == -1 ||
+        read_full(fd_in, stats, sizeof(Stats)) != sizeof(Stats)) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Read the header of the next request.  Returns 1, 0 once the other
+* end has closed the connection, or -1 for a malformed request.
+*/
+int recv_request(int fd, RequestHeader *header) {
+    int r;
+    if ((r = read_full(fd, header, sizeof(RequestHeader))) <= 0) {
+        return r;
+    }
+    if (header->type < REQUEST_QUERY || header->type > REQUEST_STATS ||
+        header->length < 0 || header->limit < 0 ||
+        (header->type == REQUEST_QUERY && header->length >= MAXLINE) ||
+        (header->type == REQUEST_BATCH && header->length > MAXBATCH)) {
+        return -1;
+    }
+    return 1;
+}
+
+/* Read the text of a query request into buf (of size MAXLINE).  Returns
+* -1 if the request is cut short.
+*/
+int recv_query(int fd, RequestHeader *header, char *buf) {
+    if (read_full(fd, buf, header->length) != header->length) {
+        return -1;
+    }
+    buf[header->length] = '\0';
+    return 0;
+}
+
+/* Read the words of a batch request into a newly allocated array of
+* header->length words of MAXWORD bytes, or return NULL if the request
+* is cut short.
+*/
+char *recv_batch(int fd, RequestHeader *header) {
+    int bytes = header->length * MAXWORD;
+    char *words = malloc(bytes > 0 ? bytes : 1);
+    int i;
+    if (words == NULL) {
+        perror("ERROR: Malloc failed");
+        exit(1);
+    }
+    if (read_full(fd, words, bytes) != bytes) {
+        free(words);
+        return NULL;
+    }
+    for (i = 0; i < header->length; i++) {
+        words[i * MAXWORD + MAXWORD - 1] = '\0';
+    }
+    return words;
+}
+
+/* Answer a batch of sorted words in one forward pass over the terms of
+* the index: the term iterator only ever moves ahead, skipping whole
+* blocks that hold none of the words.  For each word, the records (as
+* for get_query) are written to out, followed by a record with a
+* frequency of 0.  Returns the number of records written, or -1 if the
+* write fails.
+*/
+int answer_batch(DiskIndex *index, FileTable *files, char *words,
+                 int num_words, int flags, int out) {
+    TermIter iter;
+    TermInfo term;
+    HitList hits;
+    FreqRecord *frp;
+    FreqRecord end;
+    uint32_t block, term_block = 0;
+    int i, cmp, have_term = 0;
+    int records = 0;
+    char *word;
+
+    memset(&end, 0, sizeof(end));
+    seek_terms(&iter, index, 0);
+    for (i = 0; i < num_words; i++) {
+        word = words + i * MAXWORD;
+        block = find_block(index, word);
+        if (have_term ? block > term_block : block > iter.block) {
+            seek_terms(&iter, index, block);
+            have_term = 0;
+        }
+        // the last term read is kept, as it may be the next word
+        cmp = 1;
+        while (1) {
+            if (!have_term) {
+                term_block = iter.block;
+                if (!next_term(&iter, &term)) {
+                    break;
+                }
+                have_term = 1;
+            }
+            if ((cmp = strcmp(term.word, word)) >= 0) {
+                break;
+            }
+            have_term = 0;
+        }
+
+        if (cmp == 0) {
+            hits = postings_hits(index, &term);
+            frp = hits_to_records(files, &hits, flags);
+            if (write_full(out, frp, term.num_postings * sizeof(FreqRecord)) == -1) {
+                free(frp);
+                return -1;
+            }
+            free(frp);
+            records += term.num_postings;
+        }
+        if (write_full(out, &end, sizeof(FreqRecord)) == -1) {
+            return -1;
+        }
+    }
+    return records;
+}
+
+/* Strip trailing white space (such as the newline) from a query word.
+*/
+void trim_query(char *word) {
+    int i = strlen(word);
+    while (i > 0 && (word[i-1] == '\n' || word[i-1] == '\r' ||
+                     word[i-1] == ' ' || word[i-1] == '\t')) {
+        i--;
+    }
+    word[i] = '\0';
+}
+
 /* run_worker
-* - load the index found in dirname
-* - read a word from the file descriptor "in"
-* - find the word in the index list
-* - write the frequency records to the file descriptor "out"
+* - map the index found in dirname once
+* - read framed queries from the file descriptor "in" until the
+*   master closes it
+* - for each query, reload the index if the indexer has replaced it
+*   (keeping the old one until the new one loads),
+*   evaluate the query against the index and write the
+*   frequency records to the file descriptor "out", followed by a
+*   record with a frequency of 0 to mark the end of the response
+* - a batch of words is answered the same way, one response per word
+* - a stats request is answered with the worker's counters
 */
 void run_worker(char *dirname, int in, int out){
-    Node *head = NULL;
-	char listfile[PATHLENGTH];
-    char namefile[PATHLENGTH];
-    char buf[MAXWORD];
-    int index = 0;
-    int last_char_index = 0;
-    strcpy(listfile, dirname);
-    strcat(listfile, "/index");
-    strcpy(namefile, dirname);
-    strcat(namefile, "/filenames");
-    char **filenames = init_filenames();
-    read_list(listfile, namefile, &head, filenames);
-    read(in, buf, MAXWORD);
-    while (index < MAXWORD) {
-        if ((buf[index] >= 65 && buf[index] <= 90) ||
-            (buf[index] >= 97 && buf[index] <= 122) ||
-            (buf[index] >= 48 && buf[index] <= 57)) {
-            last_char_index = index;
-        }
-        index++;
-    }
-    buf[last_char_index+1] = '\0';
-    FreqRecord *frp = malloc(sizeof(FreqRecord));
-    frp = get_word(head, filenames, buf);
-    index = 0;
-    while (frp != NULL && frp[index].freq != 0) {                          
-        close(in);
-        write(out, &frp[index], sizeof(FreqRecord));
-        index++;
+    DiskIndex diskindex;
+    FileTable files;
+    RequestHeader header;
+    char buf[MAXLINE];
+    char *words;
+    FreqRecord end;
+    Stats stats;
+    unsigned long long generation = index_generation(dirname);
+    unsigned long long current, start;
+    int records, r;
+    init_stats(&stats);
+    start = stats_clock();
+    load_index(dirname, &diskindex, &files);
+    stop_timer(&stats, TIMER_LOAD, start);
+    stats.counters[STAT_INDEX_LOADS]++;
+    memset(&end, 0, sizeof(end));
+    while ((r = recv_request(in, &header)) != 0) {
+        if (r == -1) {
+            fprintf(stderr, "worker: bad request\n");
+            exit(1);
+        }
+        if (header.type == REQUEST_STATS) {
+            if (write_full(out, &stats, sizeof(stats)) == -1) {
+                perror("worker: write");
+                exit(1);
+            }
+            continue;
+        }
+        current = index_generation(dirname);
+        if (current != 0 && current != generation) {
+            start = stats_clock();
+            if (reload_index(dirname, &diskindex, &files) == 0) {
+                stop_timer(&stats, TIMER_LOAD, start);
+                stats.counters[STAT_INDEX_LOADS]++;
+                generation = current;
+            }
+        }
+        if (header.type == REQUEST_BATCH) {
+            if ((words = recv_batch(in, &header)) == NULL) {
+                fprintf(stderr, "worker: bad request\n");
+                exit(1);
+            }
+            start = stats_clock();
+            if ((records = answer_batch(&diskindex, &files, words, header.length,
+                                        header.flags, out)) == -1) {
+                perror("worker: write");
+                exit(1);
+            }
+            stop_timer(&stats, TIMER_LOOKUP, start);
+            stats.counters[STAT_LOOKUPS] += header.length;
+            stats.counters[STAT_RECORDS] += records;
+            free(words);
+            continue;
+        }
+        if (recv_query(in, &header, buf) == -1) {
+            fprintf(stderr, "worker: bad request\n");
+            exit(1);
+        }
+        trim_query(buf);
+        start = stats_clock();
+        FreqRecord *frp = get_query(&diskindex, &files, buf, header.flags,
+                                    header.limit);
+        int index = 0;
+        while (frp[index].freq != 0) {
+            index++;
+        }
+        stop_timer(&stats, TIMER_LOOKUP, start);
+        stats.counters[STAT_LOOKUPS]++;
+        stats.counters[STAT_RECORDS] += index;
+        if (write_full(out, frp, index * sizeof(FreqRecord)) == -1 ||
+            write_full(out, &end, sizeof(FreqRecord)) == -1) {
+            perror("worker: write");
+            exit(1);
+        }
+        free(frp);
     }
+    close_index(&diskindex);
+    free_filenames(&files);
 }
@@ -1,15 +1,61 @@
 #define PATHLENGTH 128
-#define MAXRECORDS 100
+#define MAXRECORDS 100     // default number of results shown by query
+#ifndef MAXBATCH
+#define MAXBATCH (1 << 22) // most words in one batch request
+#endif
+
+// worker.h expects freq_list.h, diskindex.h and search.h to be included
+// first.
 
 // This data structure is used by the workers to prepare the output
 // to be sent to the master process.
 
+// freq is the number of occurrences of the query's terms in the file and
+// score the value results are ranked by: BM25 for ranked queries, and
+// otherwise freq itself.
+
 typedef struct {
 	int freq;
+	double score;
 	char filename[PATHLENGTH];
 } FreqRecord;
 
-void sort(FreqRecord *frps);
-FreqRecord *get_word(Node *head, char **filename, char *word);
+// Header of a request sent from the master to a worker.  A query is
+// followed by length bytes of query text; a batch by length words of
+// MAXWORD bytes each, sorted and without duplicates.  A stats request
+// has no body and is answered with the worker's Stats.  limit is the
+// number of results the master keeps of a query (0 for all of them),
+// so that the worker can leave out files that can not make the cut.
+
+#define REQUEST_QUERY 1
+#define REQUEST_BATCH 2
+#define REQUEST_STATS 3
+
+typedef struct {
+	int type;
+	int flags;      // QUERY_RANKED
+	int length;
+	int limit;
+} RequestHeader;
+
+FreqRecord *get_word(DiskIndex *index, FileTable *files, char *word);
+FreqRecord *get_query(DiskIndex *index, FileTable *files, char *query, int flags,
+                      int limit);
+FreqRecord *get_term(DiskIndex *index, FileTable *files, char *word, int flags);
+int try_load_index(char *dirname, DiskIndex *index, FileTable *files);
+void load_index(char *dirname, DiskIndex *index, FileTable *files);
+int reload_index(char *dirname, DiskIndex *index, FileTable *files);
+unsigned long long index_generation(char *dirname);
 void print_freq_records(FreqRecord *frp);
+int read_full(int fd, void *buf, int n);
+int write_full(int fd, const void *buf, int n);
+int send_query(int fd, char *query, int flags, int limit);
+int send_batch(int fd, char *words, int num_words, int flags);
+int recv_request(int fd, RequestHeader *header);
+int recv_query(int fd, RequestHeader *header, char *buf);
+char *recv_batch(int fd, RequestHeader *header);
+int answer_batch(DiskIndex *index, FileTable *files, char *words,
+                 int num_words, int flags, int out);
+int request_stats(int fd_out, int fd_in, Stats *stats);
+void trim_query(char *word);
 void run_worker(char *dirname, int in, int out);